@@ -19,6 +19,8 @@
 #define _PAGE_BIT_PAT_LARGE	12	/* On 2MB or 1GB pages */
 #define _PAGE_BIT_SPECIAL	_PAGE_BIT_UNUSED1
 #define _PAGE_BIT_CPA_TEST	_PAGE_BIT_UNUSED1
+#define _PAGE_BIT_TRANS_HUGE	_PAGE_BIT_UNUSED3	/* transparent huge pmd */
+#define _PAGE_BIT_SPLITTING	_PAGE_BIT_UNUSED1	/* huge pmd being split */
 #define _PAGE_BIT_NX           63       /* No execute: only valid after cpuid check */
 
 /* If _PAGE_BIT_PRESENT is clear, we use these: */
@@ -43,6 +45,8 @@
 #define _PAGE_PAT_LARGE (_AT(pteval_t, 1) << _PAGE_BIT_PAT_LARGE)
 #define _PAGE_SPECIAL	(_AT(pteval_t, 1) << _PAGE_BIT_SPECIAL)
 #define _PAGE_CPA_TEST	(_AT(pteval_t, 1) << _PAGE_BIT_CPA_TEST)
+#define _PAGE_TRANS_HUGE (_AT(pteval_t, 1) << _PAGE_BIT_TRANS_HUGE)
+#define _PAGE_SPLITTING	(_AT(pteval_t, 1) << _PAGE_BIT_SPLITTING)
 #define __HAVE_ARCH_PTE_SPECIAL
 
 #if defined(CONFIG_X86_64) || defined(CONFIG_X86_PAE)
@@ -589,6 +593,99 @@ static inline void ptep_set_wrprotect(struct mm_struct *mm,
 	pte_update(mm, addr, ptep);
 }
 
+static inline int pmd_write(pmd_t pmd)
+{
+	return pmd_val(pmd) & _PAGE_RW;
+}
+
+static inline int pmd_young(pmd_t pmd)
+{
+	return pmd_val(pmd) & _PAGE_ACCESSED;
+}
+
+extern int pmdp_clear_flush_young(struct vm_area_struct *vma,
+				  unsigned long address, pmd_t *pmdp);
+extern pmd_t pmdp_clear_flush(struct vm_area_struct *vma,
+			      unsigned long address, pmd_t *pmdp);
+extern void pmdp_splitting_flush(struct vm_area_struct *vma,
+				 unsigned long address, pmd_t *pmdp);
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Anonymous memory mapped by a single pmd (see mm/huge_memory.c).  Such
+ * pmds carry _PAGE_TRANS_HUGE on top of _PAGE_PSE so that they can be told
+ * apart from hugetlbfs and kernel large page mappings.
+ */
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return (pmd_val(pmd) & (_PAGE_PSE | _PAGE_TRANS_HUGE)) ==
+		(_PAGE_PSE | _PAGE_TRANS_HUGE);
+}
+
+static inline int pmd_trans_splitting(pmd_t pmd)
+{
+	return pmd_val(pmd) & _PAGE_SPLITTING;
+}
+
+static inline int has_transparent_hugepage(void)
+{
+	return cpu_has_pse;
+}
+
+static inline pmd_t pmd_mkhuge(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) | _PAGE_PSE | _PAGE_TRANS_HUGE);
+}
+
+static inline pmd_t pmd_mkold(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) & ~_PAGE_ACCESSED);
+}
+
+static inline pmd_t pmd_mkyoung(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) | _PAGE_ACCESSED);
+}
+
+static inline pmd_t pmd_mkdirty(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) | _PAGE_DIRTY);
+}
+
+static inline pmd_t pmd_mkwrite(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) | _PAGE_RW);
+}
+
+static inline pmd_t pmd_wrprotect(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) & ~_PAGE_RW);
+}
+
+static inline pmd_t pmd_mknotpresent(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) & ~_PAGE_PRESENT);
+}
+
+/* page, protection -> pmd, like mk_pte() */
+#define mk_pmd(page, pgprot)						\
+	__pmd(((phys_addr_t)page_to_pfn(page) << PAGE_SHIFT) |		\
+	      massage_pgprot(pgprot))
+
+static inline void set_pmd_at(struct mm_struct *mm, unsigned long addr,
+			      pmd_t *pmdp, pmd_t pmd)
+{
+	set_pmd(pmdp, pmd);
+}
+
+static inline pmd_t pmdp_get_and_clear(struct mm_struct *mm,
+				       unsigned long addr, pmd_t *pmdp)
+{
+	return native_make_pmd(xchg(&pmdp->pmd, 0));
+}
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /*
  * clone_pgd_range(pgd_t *dst, pgd_t *src, int count);
  *
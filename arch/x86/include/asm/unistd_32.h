@@ -338,6 +338,10 @@
 #define __NR_dup3		330
 #define __NR_pipe2		331
 #define __NR_inotify_init1	332
+/* 333 - 336 reserved */
+#define __NR_recvmmsg		337
+/* 338 - 344 reserved */
+#define __NR_sendmmsg		345
 
 #ifdef __KERNEL__
 
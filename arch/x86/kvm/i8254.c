@@ -471,7 +471,7 @@ static void pit_ioport_read(struct kvm_io_device *this,
 }
 
 static int pit_in_range(struct kvm_io_device *this, gpa_t addr,
-			int len, int is_write)
+			int len, int is_write, const void *val)
 {
 	return ((addr >= KVM_PIT_BASE_ADDRESS) &&
 		(addr < KVM_PIT_BASE_ADDRESS + KVM_PIT_MEM_LENGTH));
@@ -513,7 +513,7 @@ static void speaker_ioport_read(struct kvm_io_device *this,
 }
 
 static int speaker_in_range(struct kvm_io_device *this, gpa_t addr,
-			    int len, int is_write)
+			    int len, int is_write, const void *val)
 {
 	return (addr == KVM_SPEAKER_BASE_ADDRESS);
 }
@@ -418,7 +418,7 @@ static u32 elcr_ioport_read(void *opaque, u32 addr1)
 }
 
 static int picdev_in_range(struct kvm_io_device *this, gpa_t addr,
-			   int len, int is_write)
+			   int len, int is_write, const void *val)
 {
 	switch (addr) {
 	case 0x20:
@@ -148,7 +148,12 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 		pmd_t pmd = *pmdp;
 
 		next = pmd_addr_end(addr, end);
-		if (pmd_none(pmd))
+		/*
+		 * Transparent huge pages may be split under us, and the
+		 * split does not carry over references taken on tail
+		 * pages: let the slow path split them first.
+		 */
+		if (pmd_none(pmd) || pmd_trans_huge(pmd))
 			return 0;
 		if (unlikely(pmd_large(pmd))) {
 			if (!gup_huge_pmd(pmd, addr, next, write, pages, nr))
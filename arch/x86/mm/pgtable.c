@@ -313,6 +313,49 @@ int ptep_clear_flush_young(struct vm_area_struct *vma,
 	return young;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+int pmdp_clear_flush_young(struct vm_area_struct *vma,
+			   unsigned long address, pmd_t *pmdp)
+{
+	int young = 0;
+
+	VM_BUG_ON(address & ~PMD_MASK);
+	if (pmd_young(*pmdp))
+		young = test_and_clear_bit(_PAGE_BIT_ACCESSED,
+					   (unsigned long *)&pmdp->pmd);
+	if (young)
+		flush_tlb_range(vma, address, address + PMD_SIZE);
+
+	return young;
+}
+
+pmd_t pmdp_clear_flush(struct vm_area_struct *vma,
+		       unsigned long address, pmd_t *pmdp)
+{
+	pmd_t pmd;
+
+	VM_BUG_ON(address & ~PMD_MASK);
+	pmd = pmdp_get_and_clear(vma->vm_mm, address, pmdp);
+	flush_tlb_range(vma, address, address + PMD_SIZE);
+
+	return pmd;
+}
+
+void pmdp_splitting_flush(struct vm_area_struct *vma,
+			  unsigned long address, pmd_t *pmdp)
+{
+	int set;
+
+	VM_BUG_ON(address & ~PMD_MASK);
+	set = !test_and_set_bit(_PAGE_BIT_SPLITTING,
+				(unsigned long *)&pmdp->pmd);
+	if (set) {
+		/* need tlb flush only to serialize against gup-fast */
+		flush_tlb_range(vma, address, address + PMD_SIZE);
+	}
+}
+#endif
+
 int fixmaps_set;
 
 void __native_set_fixmap(enum fixed_addresses idx, pte_t pte)
@@ -0,0 +1,405 @@
+/*
+ * xvmalloc memory allocator
+ *
+ * Each pool page is carved into variable sized blocks, every block
+ * preceded by a small header holding its size, the offset of the block
+ * before it in the same page and two flag bits.  Free blocks are kept
+ * on segregated free lists, one per FL_DELTA sized class, and a bitmap
+ * of non-empty lists makes finding a big enough block a single bit
+ * search.  Freeing a block coalesces it with its free neighbours, and a
+ * page whose blocks are all free again goes back to the page allocator.
+ *
+ * Allocation and free are O(1) and the pages may come from highmem:
+ * a block is only mapped (kmap_atomic) while the pool lock is held.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include "xvmalloc.h"
+
+/* Every block header, and so every object, is XV_ALIGN aligned */
+#define XV_ALIGN_SHIFT		2
+#define XV_ALIGN		(1 << XV_ALIGN_SHIFT)
+#define XV_ALIGN_MASK		(XV_ALIGN - 1)
+
+/* Free blocks must have room for the free list links */
+#define XV_MIN_ALLOC_SIZE	32
+#define XV_MAX_ALLOC_SIZE	(PAGE_SIZE - XV_ALIGN)
+
+/* Free list i holds blocks of [MIN + i * FL_DELTA, MIN + (i + 1) * FL_DELTA) */
+#define FL_DELTA_SHIFT		3
+#define FL_DELTA		(1 << FL_DELTA_SHIFT)
+#define NUM_FREE_LISTS	(((XV_MAX_ALLOC_SIZE - XV_MIN_ALLOC_SIZE) \
+				>> FL_DELTA_SHIFT) + 1)
+
+/* Flags kept in the low bits of block_header.prev */
+enum blockflags {
+	BLOCK_FREE,
+	PREV_FREE,
+	__NR_BLOCKFLAGS,
+};
+
+struct link_free {
+	struct page *prev_page;
+	struct page *next_page;
+	u16 prev_offset;
+	u16 next_offset;
+};
+
+struct block_header {
+	union {
+		/* This common header must be XV_ALIGN bytes */
+		u8 common[XV_ALIGN];
+		struct {
+			u16 size;
+			u16 prev;
+		};
+	};
+	/* Only valid while the block is free */
+	struct link_free link;
+};
+
+struct freelist_entry {
+	struct page *page;
+	u16 offset;
+};
+
+struct xv_pool {
+	unsigned long flbitmap[BITS_TO_LONGS(NUM_FREE_LISTS)];
+	struct freelist_entry freelist[NUM_FREE_LISTS];
+	u64 total_pages;	/* stats */
+	spinlock_t lock;
+};
+
+static inline int test_flag(struct block_header *block, enum blockflags flag)
+{
+	return block->prev & (1 << flag);
+}
+
+static inline void set_flag(struct block_header *block, enum blockflags flag)
+{
+	block->prev |= 1 << flag;
+}
+
+static inline void clear_flag(struct block_header *block, enum blockflags flag)
+{
+	block->prev &= ~(1 << flag);
+}
+
+static inline u32 get_blockprev(struct block_header *block)
+{
+	return block->prev & ~XV_ALIGN_MASK;
+}
+
+static inline void set_blockprev(struct block_header *block, u16 new_offset)
+{
+	block->prev = new_offset | (block->prev & XV_ALIGN_MASK);
+}
+
+static inline struct block_header *block_next(struct block_header *block)
+{
+	return (struct block_header *)((char *)block + block->size + XV_ALIGN);
+}
+
+/* Is the block at @offset the last one in its page? */
+static inline int block_is_last(struct block_header *block, u32 offset)
+{
+	return offset + XV_ALIGN + block->size >= PAGE_SIZE;
+}
+
+static inline u32 get_index(u32 size)
+{
+	return (size - XV_MIN_ALLOC_SIZE) >> FL_DELTA_SHIFT;
+}
+
+static struct block_header *get_ptr_atomic(struct page *page, u16 offset,
+					   enum km_type type)
+{
+	unsigned char *base;
+
+	base = kmap_atomic(page, type);
+	return (struct block_header *)(base + offset);
+}
+
+static void put_ptr_atomic(void *ptr, enum km_type type)
+{
+	kunmap_atomic(ptr, type);
+}
+
+/*
+ * Find a free block of at least @size bytes: @size is FL_DELTA aligned,
+ * so any block on the list of its own class is big enough.
+ */
+static void find_block(struct xv_pool *pool, u32 size,
+		       struct page **page, u32 *offset)
+{
+	u32 index;
+
+	index = find_next_bit(pool->flbitmap, NUM_FREE_LISTS, get_index(size));
+	if (index >= NUM_FREE_LISTS) {
+		*page = NULL;
+		return;
+	}
+
+	*page = pool->freelist[index].page;
+	*offset = pool->freelist[index].offset;
+}
+
+/*
+ * Insert the free @block at <@page, @offset> (mapped by the caller with
+ * KM_USER0) at the head of its free list.
+ */
+static void insert_block(struct xv_pool *pool, struct page *page, u32 offset,
+			 struct block_header *block)
+{
+	u32 index = get_index(block->size);
+	struct block_header *nextblock;
+
+	block->link.prev_page = NULL;
+	block->link.prev_offset = 0;
+	block->link.next_page = pool->freelist[index].page;
+	block->link.next_offset = pool->freelist[index].offset;
+	pool->freelist[index].page = page;
+	pool->freelist[index].offset = offset;
+
+	if (block->link.next_page) {
+		nextblock = get_ptr_atomic(block->link.next_page,
+					   block->link.next_offset, KM_USER1);
+		nextblock->link.prev_page = page;
+		nextblock->link.prev_offset = offset;
+		put_ptr_atomic(nextblock, KM_USER1);
+	}
+
+	__set_bit(index, pool->flbitmap);
+}
+
+/*
+ * Unlink the free @block at <@page, @offset> from its free list.
+ */
+static void remove_block(struct xv_pool *pool, struct page *page, u32 offset,
+			 struct block_header *block)
+{
+	u32 index = get_index(block->size);
+	struct block_header *tmpblock;
+
+	if (block->link.prev_page) {
+		tmpblock = get_ptr_atomic(block->link.prev_page,
+					  block->link.prev_offset, KM_USER1);
+		tmpblock->link.next_page = block->link.next_page;
+		tmpblock->link.next_offset = block->link.next_offset;
+		put_ptr_atomic(tmpblock, KM_USER1);
+	}
+
+	if (block->link.next_page) {
+		tmpblock = get_ptr_atomic(block->link.next_page,
+					  block->link.next_offset, KM_USER1);
+		tmpblock->link.prev_page = block->link.prev_page;
+		tmpblock->link.prev_offset = block->link.prev_offset;
+		put_ptr_atomic(tmpblock, KM_USER1);
+	}
+
+	if (pool->freelist[index].page == page &&
+	    pool->freelist[index].offset == offset) {
+		pool->freelist[index].page = block->link.next_page;
+		pool->freelist[index].offset = block->link.next_offset;
+		if (!pool->freelist[index].page)
+			__clear_bit(index, pool->flbitmap);
+	}
+}
+
+/*
+ * Add a fresh page to the pool, as a single free block.
+ */
+static int grow_pool(struct xv_pool *pool, gfp_t flags)
+{
+	struct page *page;
+	struct block_header *block;
+
+	page = alloc_page(flags);
+	if (unlikely(!page))
+		return -ENOMEM;
+
+	spin_lock(&pool->lock);
+	pool->total_pages++;
+
+	block = get_ptr_atomic(page, 0, KM_USER0);
+	block->size = PAGE_SIZE - XV_ALIGN;
+	block->prev = 0;
+	set_flag(block, BLOCK_FREE);
+	insert_block(pool, page, 0, block);
+	put_ptr_atomic(block, KM_USER0);
+
+	spin_unlock(&pool->lock);
+
+	return 0;
+}
+
+struct xv_pool *xv_create_pool(void)
+{
+	struct xv_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+
+	return pool;
+}
+
+void xv_destroy_pool(struct xv_pool *pool)
+{
+	kfree(pool);
+}
+
+/**
+ * xv_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @page: page no. that holds the object
+ * @offset: location of object within page
+ * @flags: gfp flags used when the pool has to grow
+ *
+ * On success, <page, offset> identifies the object, and the caller
+ * maps it with kmap_atomic() to access it.
+ *
+ * Returns 0 on success, -ENOMEM otherwise.
+ */
+int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
+		u32 *offset, gfp_t flags)
+{
+	int error;
+	u32 remaining, tmpoffset;
+	struct block_header *block, *tmpblock;
+
+	*page = NULL;
+	*offset = 0;
+
+	if (unlikely(!size))
+		return -ENOMEM;
+
+	size = ALIGN(max_t(u32, size, XV_MIN_ALLOC_SIZE), FL_DELTA);
+	if (unlikely(size > XV_MAX_ALLOC_SIZE))
+		return -ENOMEM;
+
+	spin_lock(&pool->lock);
+	find_block(pool, size, page, offset);
+	if (!*page) {
+		spin_unlock(&pool->lock);
+		error = grow_pool(pool, flags);
+		if (unlikely(error))
+			return error;
+
+		spin_lock(&pool->lock);
+		find_block(pool, size, page, offset);
+		if (unlikely(!*page)) {
+			/* Somebody else took the new page meanwhile */
+			spin_unlock(&pool->lock);
+			return -ENOMEM;
+		}
+	}
+
+	block = get_ptr_atomic(*page, *offset, KM_USER0);
+	remove_block(pool, *page, *offset, block);
+
+	remaining = block->size - size;
+	if (remaining >= XV_ALIGN + XV_MIN_ALLOC_SIZE) {
+		/* Split off the tail as a new free block */
+		block->size = size;
+		tmpoffset = *offset + XV_ALIGN + size;
+		tmpblock = block_next(block);
+		tmpblock->size = remaining - XV_ALIGN;
+		tmpblock->prev = 0;
+		set_blockprev(tmpblock, *offset);
+		set_flag(tmpblock, BLOCK_FREE);
+		insert_block(pool, *page, tmpoffset, tmpblock);
+
+		/* The block after it still has PREV_FREE set */
+		if (!block_is_last(tmpblock, tmpoffset))
+			set_blockprev(block_next(tmpblock), tmpoffset);
+	} else {
+		/* Use the whole block */
+		if (!block_is_last(block, *offset))
+			clear_flag(block_next(block), PREV_FREE);
+	}
+	clear_flag(block, BLOCK_FREE);
+
+	put_ptr_atomic(block, KM_USER0);
+	spin_unlock(&pool->lock);
+
+	*offset += XV_ALIGN;
+
+	return 0;
+}
+
+/*
+ * Free block identified with <page, offset>
+ */
+void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
+{
+	struct block_header *block, *tmpblock;
+	u32 tmpoffset;
+
+	offset -= XV_ALIGN;
+
+	spin_lock(&pool->lock);
+
+	block = get_ptr_atomic(page, offset, KM_USER0);
+
+	/* Catch double free bugs */
+	BUG_ON(test_flag(block, BLOCK_FREE));
+
+	/* Merge next block if it is free */
+	if (!block_is_last(block, offset)) {
+		tmpblock = block_next(block);
+		if (test_flag(tmpblock, BLOCK_FREE)) {
+			remove_block(pool, page, offset + XV_ALIGN + block->size,
+				     tmpblock);
+			block->size += XV_ALIGN + tmpblock->size;
+		}
+	}
+
+	/* Merge previous block if it is free */
+	if (test_flag(block, PREV_FREE)) {
+		tmpoffset = get_blockprev(block);
+		tmpblock = (struct block_header *)((char *)block -
+						   offset + tmpoffset);
+		remove_block(pool, page, tmpoffset, tmpblock);
+		tmpblock->size += XV_ALIGN + block->size;
+		block = tmpblock;
+		offset = tmpoffset;
+	}
+
+	/* No used objects left in this page: give it back */
+	if (block->size == PAGE_SIZE - XV_ALIGN) {
+		put_ptr_atomic(block, KM_USER0);
+		pool->total_pages--;
+		spin_unlock(&pool->lock);
+
+		__free_page(page);
+		return;
+	}
+
+	set_flag(block, BLOCK_FREE);
+	insert_block(pool, page, offset, block);
+
+	if (!block_is_last(block, offset)) {
+		tmpblock = block_next(block);
+		set_flag(tmpblock, PREV_FREE);
+		set_blockprev(tmpblock, offset);
+	}
+
+	put_ptr_atomic(block, KM_USER0);
+	spin_unlock(&pool->lock);
+}
+
+u64 xv_get_total_size_bytes(struct xv_pool *pool)
+{
+	return pool->total_pages << PAGE_SHIFT;
+}
@@ -0,0 +1,27 @@
+/*
+ * xvmalloc memory allocator
+ *
+ * A small allocator for the compressed pages kept by zram.  Objects are
+ * packed into (possibly highmem) pages and addressed by <page, offset>
+ * pairs, so that no part of the pool needs a permanent kernel mapping.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#ifndef _XV_MALLOC_H_
+#define _XV_MALLOC_H_
+
+#include <linux/types.h>
+
+struct xv_pool;
+
+struct xv_pool *xv_create_pool(void);
+void xv_destroy_pool(struct xv_pool *pool);
+
+int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
+			u32 *offset, gfp_t flags);
+void xv_free(struct xv_pool *pool, struct page *page, u32 offset);
+
+u64 xv_get_total_size_bytes(struct xv_pool *pool);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Compressed RAM block device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#ifndef _ZRAM_DRV_H_
+#define _ZRAM_DRV_H_
+
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+#include "xvmalloc.h"
+
+/* Sanity limit for the num_devices module parameter */
+#define ZRAM_MAX_DEVICES	32
+
+/*
+ * Pages that compress to more than this are stored uncompressed: the
+ * allocator could not pack them with anything else anyway.
+ */
+#define ZRAM_MAX_ZPAGE_SIZE	(PAGE_SIZE / 4 * 3)
+
+#define SECTOR_SHIFT		9
+#define SECTOR_SIZE		(1 << SECTOR_SHIFT)
+#define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
+
+/*
+ * Largest request we take, a whole number of pages that still fits in
+ * bi_size: discards are split at this boundary (see create_device()).
+ */
+#define ZRAM_MAX_SECTORS	((UINT_MAX >> SECTOR_SHIFT) & \
+					~(SECTORS_PER_PAGE - 1))
+
+/* Flags for zram pages (table[page_no].flags) */
+enum zram_pageflags {
+	/* Page is stored uncompressed */
+	ZRAM_UNCOMPRESSED,
+
+	/* Page consists entirely of zeros */
+	ZRAM_ZERO,
+
+	__NR_ZRAM_PAGEFLAGS,
+};
+
+/* Allocated for each disk page */
+struct zram_table_entry {
+	struct page *page;
+	u16 offset;
+	u16 size;	/* object size, PAGE_SIZE when uncompressed */
+	u8 flags;
+};
+
+struct zram_stats {
+	u64 compr_size;		/* compressed size of pages stored */
+	u64 num_reads;		/* failed + successful */
+	u64 num_writes;		/* --do-- */
+	u64 failed_reads;	/* can happen when memory is too low */
+	u64 failed_writes;	/* should NEVER! happen */
+	u64 invalid_io;		/* non-page-aligned I/O requests */
+	u64 notify_free;	/* pages freed by discard or swap free */
+	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_stored;	/* no. of pages currently stored */
+	u32 good_compress;	/* no. of pages with compression ratio<=50% */
+	u32 pages_expand;	/* no. of incompressible pages */
+};
+
+struct zram {
+	struct xv_pool *mem_pool;
+	void *compress_workmem;
+	void *compress_buffer;
+	struct zram_table_entry *table;
+	unsigned long *free_pending;	/* swap slots to free */
+	struct work_struct free_work;
+	spinlock_t stat64_lock;	/* protect 64-bit stats */
+	struct rw_semaphore lock; /* protect table and compression buffers */
+	struct mutex init_lock;	/* serialize device init and reset */
+	struct request_queue *queue;
+	struct gendisk *disk;
+	int init_done;
+	/*
+	 * This is the limit on amount of *uncompressed* worth of data
+	 * we can store in a disk.
+	 */
+	u64 disksize;	/* bytes */
+
+	struct zram_stats stats;
+};
+
+#endif
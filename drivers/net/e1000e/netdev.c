@@ -99,8 +99,8 @@ static void e1000_receive_skb(struct e1000_adapter *adapter,
 	skb->protocol = eth_type_trans(skb, netdev);
 
 	if (adapter->vlgrp && (status & E1000_RXD_STAT_VP))
-		vlan_hwaccel_receive_skb(skb, adapter->vlgrp,
-					 le16_to_cpu(vlan));
+		vlan_gro_receive(&adapter->napi, adapter->vlgrp,
+				 le16_to_cpu(vlan), skb);
 	else
 		napi_gro_receive(&adapter->napi, skb);
 }
@@ -662,6 +662,8 @@ static bool e1000_clean_tx_irq(struct e1000_adapter *adapter)
 
 	tx_ring->next_to_clean = i;
 
+	netdev_completed_queue(netdev, total_tx_packets, total_tx_bytes);
+
 #define TX_WAKE_THRESHOLD 32
 	if (cleaned && netif_carrier_ok(netdev) &&
 		     e1000_desc_unused(tx_ring) >= TX_WAKE_THRESHOLD) {
@@ -1784,6 +1786,7 @@ static void e1000_clean_tx_ring(struct e1000_adapter *adapter)
 
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
+	netdev_reset_queue(adapter->netdev);
 
 	writel(0, adapter->hw.hw_addr + tx_ring->head);
 	writel(0, adapter->hw.hw_addr + tx_ring->tail);
@@ -4074,6 +4077,7 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	unsigned int mss;
 	int count = 0;
 	int tso;
+	int segs;
 	unsigned int f;
 
 	if (test_bit(__E1000_DOWN, &adapter->state)) {
@@ -4186,6 +4190,10 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 		return NETDEV_TX_OK;
 	}
 
+	/* account the same bytes e1000_clean_tx_irq will complete */
+	segs = skb_shinfo(skb)->gso_segs ?: 1;
+	netdev_sent_queue(netdev, ((segs - 1) * skb_headlen(skb)) + skb->len);
+
 	e1000_tx_queue(adapter, tx_flags, count);
 
 	netdev->trans_start = jiffies;
@@ -4913,11 +4921,13 @@ static int __devinit e1000_probe(struct pci_dev *pdev,
 
 	netdev->features |= NETIF_F_TSO;
 	netdev->features |= NETIF_F_TSO6;
+	netdev->features |= NETIF_F_GRO;
 
 	netdev->vlan_features |= NETIF_F_TSO;
 	netdev->vlan_features |= NETIF_F_TSO6;
 	netdev->vlan_features |= NETIF_F_HW_CSUM;
 	netdev->vlan_features |= NETIF_F_SG;
+	netdev->vlan_features |= NETIF_F_GRO;
 
 	if (pci_using_dac)
 		netdev->features |= NETIF_F_HIGHDMA;
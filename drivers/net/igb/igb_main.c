@@ -2073,6 +2073,8 @@ static void igb_clean_tx_ring(struct igb_ring *tx_ring)
 
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
+	netdev_tx_reset_queue(netdev_get_tx_queue(adapter->netdev,
+						  tx_ring->queue_index));
 
 	writel(0, adapter->hw.hw_addr + tx_ring->head);
 	writel(0, adapter->hw.hw_addr + tx_ring->tail);
@@ -2960,6 +2962,7 @@ static int igb_xmit_frame_ring_adv(struct sk_buff *skb,
 	unsigned int first;
 	unsigned int tx_flags = 0;
 	unsigned int len;
+	unsigned int segs;
 	u8 hdr_len = 0;
 	int tso = 0;
 
@@ -3010,6 +3013,11 @@ static int igb_xmit_frame_ring_adv(struct sk_buff *skb,
 			if (skb->ip_summed == CHECKSUM_PARTIAL)
 				tx_flags |= IGB_TX_FLAGS_CSUM;
 
+	/* account the same bytes igb_clean_tx_irq will complete */
+	segs = skb_shinfo(skb)->gso_segs ?: 1;
+	netdev_tx_sent_queue(netdev_get_tx_queue(netdev, tx_ring->queue_index),
+			     ((segs - 1) * skb_headlen(skb)) + skb->len);
+
 	igb_tx_queue_adv(adapter, tx_ring, tx_flags,
 			 igb_tx_map_adv(adapter, tx_ring, skb, first),
 			 skb->len, hdr_len);
@@ -3684,6 +3692,10 @@ static bool igb_clean_tx_irq(struct igb_ring *tx_ring)
 
 	tx_ring->next_to_clean = i;
 
+	netdev_tx_completed_queue(netdev_get_tx_queue(netdev,
+						      tx_ring->queue_index),
+				  total_packets, total_bytes);
+
 	if (unlikely(count &&
 		     netif_carrier_ok(netdev) &&
 		     IGB_DESC_UNUSED(tx_ring) >= IGB_TX_QUEUE_WAKE)) {
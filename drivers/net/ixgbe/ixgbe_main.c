@@ -266,6 +266,10 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_adapter *adapter,
 done_cleaning:
 	tx_ring->next_to_clean = i;
 
+	netdev_tx_completed_queue(netdev_get_tx_queue(netdev,
+	                                              tx_ring->queue_index),
+	                          total_packets, total_bytes);
+
 #define TX_WAKE_THRESHOLD (DESC_NEEDED * 2)
 	if (unlikely(count && netif_carrier_ok(netdev) &&
 	             (IXGBE_DESC_UNUSED(tx_ring) >= TX_WAKE_THRESHOLD))) {
@@ -2196,6 +2200,8 @@ static void ixgbe_clean_tx_ring(struct ixgbe_adapter *adapter,
 
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
+	netdev_tx_reset_queue(netdev_get_tx_queue(adapter->netdev,
+	                                          tx_ring->queue_index));
 
 	writel(0, adapter->hw.hw_addr + tx_ring->head);
 	writel(0, adapter->hw.hw_addr + tx_ring->tail);
@@ -3833,6 +3839,7 @@ static int ixgbe_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	int r_idx = 0, tso;
 	int count = 0;
 	unsigned int f;
+	unsigned int segs;
 
 	r_idx = (adapter->num_tx_queues - 1) & skb->queue_mapping;
 	tx_ring = &adapter->tx_ring[r_idx];
@@ -3880,6 +3887,11 @@ static int ixgbe_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	         (skb->ip_summed == CHECKSUM_PARTIAL))
 		tx_flags |= IXGBE_TX_FLAGS_CSUM;
 
+	/* account the same bytes ixgbe_clean_tx_irq will complete */
+	segs = skb_shinfo(skb)->gso_segs ?: 1;
+	netdev_tx_sent_queue(netdev_get_tx_queue(netdev, tx_ring->queue_index),
+	                     ((segs - 1) * skb_headlen(skb)) + skb->len);
+
 	ixgbe_tx_queue(adapter, tx_ring, tx_flags,
 	               ixgbe_tx_map(adapter, tx_ring, skb, first),
 	               skb->len, hdr_len);
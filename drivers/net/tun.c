@@ -87,18 +87,38 @@ struct tap_filter {
 	unsigned char	addr[FLT_EXACT_COUNT][ETH_ALEN];
 };
 
+/* Maximum number of queues (and so of attached files) of a
+ * multiqueue device. */
+#define MAX_TAP_QUEUES 8
+
+/*
+ * Per file state.  Every file attached to a device owns one queue:
+ * packets transmitted on netdev TX queue N are delivered to the read
+ * queue of the file whose queue_index is N.
+ */
+struct tun_file {
+	struct tun_struct	*tun;
+	u16			queue_index;
+	unsigned int		flags;
+
+	wait_queue_head_t	read_wait;
+	struct sk_buff_head	readq;
+
+	struct fasync_struct	*fasync;
+
+	/* In-kernel users (vhost-net) send and receive through this. */
+	struct socket		socket;
+};
+
 struct tun_struct {
 	struct list_head        list;
 	unsigned int 		flags;
-	int			attached;
+	unsigned int		numqueues;
+	struct tun_file		*tfiles[MAX_TAP_QUEUES];
 	uid_t			owner;
 	gid_t			group;
 
-	wait_queue_head_t	read_wait;
-	struct sk_buff_head	readq;
-
 	struct net_device	*dev;
-	struct fasync_struct	*fasync;
 
 	struct tap_filter       txflt;
 
@@ -226,29 +246,94 @@ struct tun_net {
 
 static const struct ethtool_ops tun_ethtool_ops;
 
+static int tun_attach(struct tun_struct *tun, struct file *file)
+{
+	struct tun_file *tfile = file->private_data;
+
+	ASSERT_RTNL();
+
+	if (tun->numqueues == tun->dev->num_tx_queues)
+		return -EBUSY;
+
+	tfile->tun = tun;
+	tfile->queue_index = tun->numqueues;
+	rcu_assign_pointer(tun->tfiles[tun->numqueues], tfile);
+	tun->numqueues++;
+	get_net(dev_net(tun->dev));
+
+	return 0;
+}
+
+static void tun_detach(struct tun_file *tfile)
+{
+	struct tun_struct *tun = tfile->tun;
+	struct tun_file *last;
+	u16 index = tfile->queue_index;
+
+	ASSERT_RTNL();
+	BUG_ON(index >= tun->numqueues);
+
+	/* Keep the queue array dense: the last file takes over the
+	 * slot of the departing one. */
+	last = tun->tfiles[--tun->numqueues];
+	last->queue_index = index;
+	rcu_assign_pointer(tun->tfiles[index], last);
+	rcu_assign_pointer(tun->tfiles[tun->numqueues], NULL);
+	tfile->tun = NULL;
+	put_net(dev_net(tun->dev));
+
+	/* Wait for tun_net_xmit() to stop using the old mapping
+	 * before dropping the read queue. */
+	synchronize_net();
+	skb_queue_purge(&tfile->readq);
+
+	if (!tun->numqueues && !(tun->flags & TUN_PERSIST)) {
+		list_del(&tun->list);
+		unregister_netdevice(tun->dev);
+	} else if (netif_running(tun->dev)) {
+		/* Queues may have been renumbered. */
+		netif_tx_wake_all_queues(tun->dev);
+	}
+}
+
 /* Net device open. */
 static int tun_net_open(struct net_device *dev)
 {
-	netif_start_queue(dev);
+	netif_tx_start_all_queues(dev);
 	return 0;
 }
 
 /* Net device close. */
 static int tun_net_close(struct net_device *dev)
 {
-	netif_stop_queue(dev);
+	netif_tx_stop_all_queues(dev);
 	return 0;
 }
 
+/* Spread flows over the attached queues. */
+static u16 tun_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	struct tun_struct *tun = netdev_priv(dev);
+	unsigned int numqueues = ACCESS_ONCE(tun->numqueues);
+
+	if (numqueues <= 1)
+		return 0;
+
+	return ((u64) skb_get_rxhash(skb) * numqueues) >> 32;
+}
+
 /* Net device start xmit */
 static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
+	u16 txq = skb_get_queue_mapping(skb);
+	struct tun_file *tfile;
 
 	DBG(KERN_INFO "%s: tun_net_xmit %d\n", tun->dev->name, skb->len);
 
-	/* Drop packet if interface is not attached */
-	if (!tun->attached)
+	/* Drop packet if no file is attached to this queue */
+	tfile = rcu_dereference(tun->tfiles[txq]);
+	if (!tfile)
 		goto drop;
 
 	/* Drop if the filter does not like it.
@@ -257,11 +342,11 @@ static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	if (!check_filter(&tun->txflt, skb))
 		goto drop;
 
-	if (skb_queue_len(&tun->readq) >= dev->tx_queue_len) {
+	if (skb_queue_len(&tfile->readq) >= dev->tx_queue_len) {
 		if (!(tun->flags & TUN_ONE_QUEUE)) {
 			/* Normal queueing mode. */
 			/* Packet scheduler handles dropping of further packets. */
-			netif_stop_queue(dev);
+			netif_tx_stop_queue(netdev_get_tx_queue(dev, txq));
 
 			/* We won't see all dropped packets individually, so overrun
 			 * error is more appropriate. */
@@ -274,13 +359,13 @@ static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	/* Enqueue packet */
-	skb_queue_tail(&tun->readq, skb);
+	skb_queue_tail(&tfile->readq, skb);
 	dev->trans_start = jiffies;
 
 	/* Notify and wake up reader process */
-	if (tun->flags & TUN_FASYNC)
-		kill_fasync(&tun->fasync, SIGIO, POLL_IN);
-	wake_up_interruptible(&tun->read_wait);
+	if (tfile->flags & TUN_FASYNC)
+		kill_fasync(&tfile->fasync, SIGIO, POLL_IN);
+	wake_up_interruptible(&tfile->read_wait);
 	return 0;
 
 drop:
@@ -315,6 +400,7 @@ static const struct net_device_ops tun_netdev_ops = {
 	.ndo_open		= tun_net_open,
 	.ndo_stop		= tun_net_close,
 	.ndo_start_xmit		= tun_net_xmit,
+	.ndo_select_queue	= tun_select_queue,
 	.ndo_change_mtu		= tun_net_change_mtu,
 };
 
@@ -322,6 +408,7 @@ static const struct net_device_ops tap_netdev_ops = {
 	.ndo_open		= tun_net_open,
 	.ndo_stop		= tun_net_close,
 	.ndo_start_xmit		= tun_net_xmit,
+	.ndo_select_queue	= tun_select_queue,
 	.ndo_change_mtu		= tun_net_change_mtu,
 	.ndo_set_multicast_list	= tun_net_mclist,
 	.ndo_set_mac_address	= eth_mac_addr,
@@ -365,7 +452,8 @@ static void tun_net_init(struct net_device *dev)
 /* Poll */
 static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	unsigned int mask = POLLOUT | POLLWRNORM;
 
 	if (!tun)
@@ -373,9 +461,9 @@ static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 
 	DBG(KERN_INFO "%s: tun_chr_poll\n", tun->dev->name);
 
-	poll_wait(file, &tun->read_wait, wait);
+	poll_wait(file, &tfile->read_wait, wait);
 
-	if (!skb_queue_empty(&tun->readq))
+	if (!skb_queue_empty(&tfile->readq))
 		mask |= POLLIN | POLLRDNORM;
 
 	return mask;
@@ -562,7 +650,8 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv,
 static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 			      unsigned long count, loff_t pos)
 {
-	struct tun_struct *tun = iocb->ki_filp->private_data;
+	struct tun_file *tfile = iocb->ki_filp->private_data;
+	struct tun_struct *tun = tfile->tun;
 
 	if (!tun)
 		return -EBADFD;
@@ -642,7 +731,8 @@ static ssize_t tun_chr_aio_read(struct kiocb *iocb, const struct iovec *iv,
 			    unsigned long count, loff_t pos)
 {
 	struct file *file = iocb->ki_filp;
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	DECLARE_WAITQUEUE(wait, current);
 	struct sk_buff *skb;
 	ssize_t len, ret = 0;
@@ -656,12 +746,12 @@ static ssize_t tun_chr_aio_read(struct kiocb *iocb, const struct iovec *iv,
 	if (len < 0)
 		return -EINVAL;
 
-	add_wait_queue(&tun->read_wait, &wait);
+	add_wait_queue(&tfile->read_wait, &wait);
 	while (len) {
 		current->state = TASK_INTERRUPTIBLE;
 
 		/* Read frames from the queue */
-		if (!(skb=skb_dequeue(&tun->readq))) {
+		if (!(skb=skb_dequeue(&tfile->readq))) {
 			if (file->f_flags & O_NONBLOCK) {
 				ret = -EAGAIN;
 				break;
@@ -675,7 +765,7 @@ static ssize_t tun_chr_aio_read(struct kiocb *iocb, const struct iovec *iv,
 			schedule();
 			continue;
 		}
-		netif_wake_queue(tun->dev);
+		netif_wake_subqueue(tun->dev, tfile->queue_index);
 
 		ret = tun_put_user(tun, skb, (struct iovec *) iv, len);
 		kfree_skb(skb);
@@ -683,18 +773,71 @@ static ssize_t tun_chr_aio_read(struct kiocb *iocb, const struct iovec *iv,
 	}
 
 	current->state = TASK_RUNNING;
-	remove_wait_queue(&tun->read_wait, &wait);
+	remove_wait_queue(&tfile->read_wait, &wait);
 
 	return ret;
 }
 
+static int tun_sendmsg(struct kiocb *iocb, struct socket *sock,
+		       struct msghdr *m, size_t total_len)
+{
+	struct tun_file *tfile = container_of(sock, struct tun_file, socket);
+	struct tun_struct *tun = tfile->tun;
+
+	if (!tun)
+		return -EBADFD;
+
+	return tun_get_user(tun, m->msg_iov, total_len);
+}
+
+static int tun_recvmsg(struct kiocb *iocb, struct socket *sock,
+		       struct msghdr *m, size_t total_len,
+		       int flags)
+{
+	struct tun_file *tfile = container_of(sock, struct tun_file, socket);
+	struct tun_struct *tun = tfile->tun;
+	struct sk_buff *skb;
+	ssize_t len, ret;
+
+	if (!tun)
+		return -EBADFD;
+
+	if (flags & ~(MSG_DONTWAIT|MSG_TRUNC))
+		return -EINVAL;
+
+	/* Only non blocking reads: in-kernel users wait via poll. */
+	skb = skb_dequeue(&tfile->readq);
+	if (!skb)
+		return -EAGAIN;
+	netif_wake_subqueue(tun->dev, tfile->queue_index);
+
+	len = skb->len;
+	if (!(tun->flags & TUN_NO_PI))
+		len += sizeof(struct tun_pi);
+	if (tun->flags & TUN_VNET_HDR)
+		len += sizeof(struct virtio_net_hdr);
+
+	ret = tun_put_user(tun, skb, m->msg_iov, total_len);
+	kfree_skb(skb);
+
+	/* Like other sockets, report the real length on truncation. */
+	if (ret >= 0 && (flags & MSG_TRUNC))
+		ret = len;
+	return ret;
+}
+
+/* Ops structure to mimic raw sockets with tun */
+static const struct proto_ops tun_socket_ops = {
+	.family		= AF_UNSPEC,
+	.owner		= THIS_MODULE,
+	.sendmsg	= tun_sendmsg,
+	.recvmsg	= tun_recvmsg,
+};
+
 static void tun_setup(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
 
-	skb_queue_head_init(&tun->readq);
-	init_waitqueue_head(&tun->read_wait);
-
 	tun->owner = -1;
 	tun->group = -1;
 
@@ -727,7 +870,10 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	tn = net_generic(net, tun_net_id);
 	tun = tun_get_by_name(tn, ifr->ifr_name);
 	if (tun) {
-		if (tun->attached)
+		if (!!(ifr->ifr_flags & IFF_MULTI_QUEUE) !=
+		    !!(tun->flags & TUN_TAP_MQ))
+			return -EINVAL;
+		if (tun->numqueues == tun->dev->num_tx_queues)
 			return -EBUSY;
 
 		/* Check permissions */
@@ -744,6 +890,7 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	else {
 		char *name;
 		unsigned long flags = 0;
+		unsigned int queues = 1;
 
 		err = -EINVAL;
 
@@ -762,11 +909,16 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		} else
 			goto failed;
 
+		if (ifr->ifr_flags & IFF_MULTI_QUEUE) {
+			flags |= TUN_TAP_MQ;
+			queues = MAX_TAP_QUEUES;
+		}
+
 		if (*ifr->ifr_name)
 			name = ifr->ifr_name;
 
-		dev = alloc_netdev(sizeof(struct tun_struct), name,
-				   tun_setup);
+		dev = alloc_netdev_mq(sizeof(struct tun_struct), name,
+				      tun_setup, queues);
 		if (!dev)
 			return -ENOMEM;
 
@@ -809,15 +961,15 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	else
 		tun->flags &= ~TUN_VNET_HDR;
 
-	file->private_data = tun;
-	tun->attached = 1;
-	get_net(dev_net(tun->dev));
+	err = tun_attach(tun, file);
+	if (err < 0)
+		return err;
 
 	/* Make sure persistent devices do not get stuck in
 	 * xoff state.
 	 */
 	if (netif_running(tun->dev))
-		netif_wake_queue(tun->dev);
+		netif_tx_wake_all_queues(tun->dev);
 
 	strcpy(ifr->ifr_name, tun->dev->name);
 	return 0;
@@ -830,7 +982,8 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 
 static int tun_get_iff(struct net *net, struct file *file, struct ifreq *ifr)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 
 	if (!tun)
 		return -EBADFD;
@@ -855,6 +1008,9 @@ static int tun_get_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	if (tun->flags & TUN_VNET_HDR)
 		ifr->ifr_flags |= IFF_VNET_HDR;
 
+	if (tun->flags & TUN_TAP_MQ)
+		ifr->ifr_flags |= IFF_MULTI_QUEUE;
+
 	return 0;
 }
 
@@ -901,7 +1057,8 @@ static int set_offload(struct net_device *dev, unsigned long arg)
 static int tun_chr_ioctl(struct inode *inode, struct file *file,
 			 unsigned int cmd, unsigned long arg)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	void __user* argp = (void __user*)arg;
 	struct ifreq ifr;
 	int ret;
@@ -932,7 +1089,7 @@ static int tun_chr_ioctl(struct inode *inode, struct file *file,
 		 * This is needed because we never checked for invalid flags on
 		 * TUNSETIFF. */
 		return put_user(IFF_TUN | IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE |
-				IFF_VNET_HDR,
+				IFF_VNET_HDR | IFF_MULTI_QUEUE,
 				(unsigned int __user*)argp);
 	}
 
@@ -1049,7 +1206,8 @@ static int tun_chr_ioctl(struct inode *inode, struct file *file,
 
 static int tun_chr_fasync(int fd, struct file *file, int on)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	int ret;
 
 	if (!tun)
@@ -1058,16 +1216,16 @@ static int tun_chr_fasync(int fd, struct file *file, int on)
 	DBG(KERN_INFO "%s: tun_chr_fasync %d\n", tun->dev->name, on);
 
 	lock_kernel();
-	if ((ret = fasync_helper(fd, file, on, &tun->fasync)) < 0)
+	if ((ret = fasync_helper(fd, file, on, &tfile->fasync)) < 0)
 		goto out;
 
 	if (on) {
 		ret = __f_setown(file, task_pid(current), PIDTYPE_PID, 0);
 		if (ret)
 			goto out;
-		tun->flags |= TUN_FASYNC;
+		tfile->flags |= TUN_FASYNC;
 	} else
-		tun->flags &= ~TUN_FASYNC;
+		tfile->flags &= ~TUN_FASYNC;
 	ret = 0;
 out:
 	unlock_kernel();
@@ -1076,38 +1234,42 @@ out:
 
 static int tun_chr_open(struct inode *inode, struct file * file)
 {
+	struct tun_file *tfile;
+
 	cycle_kernel_lock();
 	DBG1(KERN_INFO "tunX: tun_chr_open\n");
-	file->private_data = NULL;
-	return 0;
-}
 
-static int tun_chr_close(struct inode *inode, struct file *file)
-{
-	struct tun_struct *tun = file->private_data;
+	tfile = kzalloc(sizeof(*tfile), GFP_KERNEL);
+	if (!tfile)
+		return -ENOMEM;
 
-	if (!tun)
-		return 0;
+	init_waitqueue_head(&tfile->read_wait);
+	skb_queue_head_init(&tfile->readq);
 
-	DBG(KERN_INFO "%s: tun_chr_close\n", tun->dev->name);
+	tfile->socket.type = SOCK_RAW;
+	tfile->socket.state = SS_CONNECTED;
+	tfile->socket.ops = &tun_socket_ops;
+	tfile->socket.file = file;
 
-	rtnl_lock();
+	file->private_data = tfile;
+	return 0;
+}
 
-	/* Detach from net device */
-	file->private_data = NULL;
-	tun->attached = 0;
-	put_net(dev_net(tun->dev));
+static int tun_chr_close(struct inode *inode, struct file *file)
+{
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 
-	/* Drop read queue */
-	skb_queue_purge(&tun->readq);
+	if (tun) {
+		DBG(KERN_INFO "%s: tun_chr_close\n", tun->dev->name);
 
-	if (!(tun->flags & TUN_PERSIST)) {
-		list_del(&tun->list);
-		unregister_netdevice(tun->dev);
+		rtnl_lock();
+		/* Detach from net device and drop read queue */
+		tun_detach(tfile);
+		rtnl_unlock();
 	}
 
-	rtnl_unlock();
-
+	kfree(tfile);
 	return 0;
 }
 
@@ -1187,7 +1349,7 @@ static void tun_set_msglevel(struct net_device *dev, u32 value)
 static u32 tun_get_link(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
-	return tun->attached;
+	return tun->numqueues != 0;
 }
 
 static u32 tun_get_rx_csum(struct net_device *dev)
@@ -1288,6 +1450,23 @@ static void tun_cleanup(void)
 	unregister_pernet_gen_device(tun_net_id, &tun_net_ops);
 }
 
+/* Get an underlying socket object from tun file.  Returns error unless file is
+ * attached to a device.  The returned object works like a packet socket, it
+ * can be used for sock_sendmsg/sock_recvmsg.  The caller is responsible for
+ * holding a reference to the file for as long as the socket is in use. */
+struct socket *tun_get_socket(struct file *file)
+{
+	struct tun_file *tfile;
+
+	if (file->f_op != &tun_fops)
+		return ERR_PTR(-EINVAL);
+	tfile = file->private_data;
+	if (!tfile->tun)
+		return ERR_PTR(-EBADFD);
+	return &tfile->socket;
+}
+EXPORT_SYMBOL_GPL(tun_get_socket);
+
 module_init(tun_init);
 module_exit(tun_cleanup);
 MODULE_DESCRIPTION(DRV_DESCRIPTION);
@@ -1340,8 +1340,12 @@ static void btrfs_unplug_io_fn(struct backing_dev_info *bdi, struct page *page)
 	free_extent_map(em);
 }
 
+static atomic_t btrfs_bdi_num = ATOMIC_INIT(0);
+
 static int setup_bdi(struct btrfs_fs_info *info, struct backing_dev_info *bdi)
 {
+	int err;
+
 	bdi_init(bdi);
 	bdi->ra_pages	= default_backing_dev_info.ra_pages;
 	bdi->state		= 0;
@@ -1350,7 +1354,11 @@ static int setup_bdi(struct btrfs_fs_info *info, struct backing_dev_info *bdi)
 	bdi->unplug_io_data	= info;
 	bdi->congested_fn	= btrfs_congested_fn;
 	bdi->congested_data	= info;
-	return 0;
+
+	/* an unregistered bdi is written back by the default flusher thread */
+	err = bdi_register(bdi, NULL, "btrfs-%d",
+			   atomic_inc_return(&btrfs_bdi_num));
+	return err;
 }
 
 static int bio_ready_for_csum(struct bio *bio)
@@ -2385,7 +2393,7 @@ void btrfs_btree_balance_dirty(struct btrfs_root *root, unsigned long nr)
 	unsigned long thresh = 32 * 1024 * 1024;
 	tree = &BTRFS_I(root->fs_info->btree_inode)->io_tree;
 
-	if (current_is_pdflush() || current->flags & PF_MEMALLOC)
+	if (current_is_flusher() || current->flags & PF_MEMALLOC)
 		return;
 
 	num_dirty = count_range_bits(tree, &start, (u64)-1,
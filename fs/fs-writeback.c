@@ -19,49 +19,165 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include <linux/writeback.h>
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
 #include <linux/buffer_head.h>
 #include "internal.h"
 
+/*
+ * The maximum number of pages to writeout in a single flusher pass.  We do
+ * this so we don't hold I_SYNC against an inode for enormous amounts of
+ * time, which would block a userspace task which has been forced to throttle
+ * against that inode.  Also, the code reevaluates the dirty each time it has
+ * written this many pages.
+ */
+#define MAX_WRITEBACK_PAGES	1024
+
+/*
+ * A flusher thread which found nothing to write for this long exits; the
+ * forker thread starts it again when its device gets dirty data.
+ */
+#define FLUSHER_IDLE_TIMEOUT	(5 * 60 * HZ)
+
+/*
+ * There is no pdflush anymore, the sysctl reporting the number of its
+ * threads is kept for compatibility.
+ */
+int nr_pdflush_threads;
+
+/*
+ * A writeback request queued on bdi->work_list for the flusher thread:
+ * write back at least nr_pages of this device, and go on while we are over
+ * the background dirty threshold.
+ */
+struct bdi_work {
+	struct list_head list;
+	long nr_pages;
+};
 
 /**
- * writeback_acquire - attempt to get exclusive writeback access to a device
- * @bdi: the device's backing_dev_info structure
- *
- * It is a waste of resources to have more than one pdflush thread blocked on
- * a single request queue.  Exclusion at the request_queue level is obtained
- * via a flag in the request_queue's backing_dev_info.state.
+ * writeback_in_progress - determine whether there is writeback in progress
+ * @bdi: the device's backing_dev_info structure.
  *
- * Non-request_queue-backed address_spaces will share default_backing_dev_info,
- * unless they implement their own.  Which is somewhat inefficient, as this
- * may prevent concurrent writeback against multiple devices.
+ * Determine whether there is writeback in progress against a backing device,
+ * or about to be: its flusher thread is running or has requests queued.
  */
-static int writeback_acquire(struct backing_dev_info *bdi)
+int writeback_in_progress(struct backing_dev_info *bdi)
 {
-	return !test_and_set_bit(BDI_pdflush, &bdi->state);
+	return test_bit(BDI_writeback_running, &bdi->state) ||
+		!list_empty(&bdi->work_list);
+}
+
+/*
+ * The backing device whose lists a dirty inode goes on.  A device which
+ * can be written back but was never registered has no flusher thread of
+ * its own, so its inodes are handed to the default bdi's thread.
+ */
+static struct backing_dev_info *inode_to_bdi(struct inode *inode)
+{
+	struct backing_dev_info *bdi = inode->i_mapping->backing_dev_info;
+
+	if (bdi_cap_writeback_dirty(bdi) &&
+	    !test_bit(BDI_registered, &bdi->state))
+		return &default_backing_dev_info;
+	return bdi;
+}
+
+/*
+ * Wake up the flusher thread of @bdi, or the forker thread which will
+ * create one.  Called with bdi_lock held, which keeps bdi->task alive.
+ */
+static void bdi_wakeup_flusher(struct backing_dev_info *bdi)
+{
+	if (bdi->task)
+		wake_up_process(bdi->task);
+	else if (default_backing_dev_info.task)
+		wake_up_process(default_backing_dev_info.task);
+}
+
+/*
+ * Queue a request for @nr_pages, or fold it into one which is still
+ * pending.  Returns -ENODEV if @bdi went away meanwhile.
+ */
+static int bdi_queue_work(struct backing_dev_info *bdi, long nr_pages)
+{
+	struct bdi_work *work;
+	int ret = 0;
+
+	work = kmalloc(sizeof(*work), GFP_ATOMIC);
+
+	spin_lock_bh(&bdi->wb_lock);
+	if (!test_bit(BDI_registered, &bdi->state)) {
+		ret = -ENODEV;
+	} else if (!list_empty(&bdi->work_list)) {
+		struct bdi_work *pending;
+
+		pending = list_entry(bdi->work_list.prev, struct bdi_work, list);
+		pending->nr_pages = max(pending->nr_pages, nr_pages);
+	} else if (work) {
+		work->nr_pages = nr_pages;
+		list_add_tail(&work->list, &bdi->work_list);
+		work = NULL;
+	}
+	/*
+	 * If the allocation failed, the wakeup still gets the flusher to do
+	 * its periodic writeback.
+	 */
+	spin_unlock_bh(&bdi->wb_lock);
+
+	kfree(work);
+	return ret;
 }
 
 /**
- * writeback_in_progress - determine whether there is writeback in progress
- * @bdi: the device's backing_dev_info structure.
+ * bdi_start_writeback - start writeback against a device
+ * @bdi: the backing device to write back
+ * @nr_pages: the minimum number of pages to write
  *
- * Determine whether there is writeback in progress against a backing device.
+ * Hand the writeback to the device's flusher thread, which writes at least
+ * @nr_pages and goes on while the system is over the background dirty
+ * threshold.  This doesn't wait for any of it to happen.
  */
-int writeback_in_progress(struct backing_dev_info *bdi)
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
 {
-	return test_bit(BDI_pdflush, &bdi->state);
+	if (!bdi_cap_writeback_dirty(bdi))
+		return;
+
+	if (bdi_queue_work(bdi, nr_pages)) {
+		bdi = &default_backing_dev_info;
+		bdi_queue_work(bdi, nr_pages);
+	}
+
+	spin_lock_bh(&bdi_lock);
+	bdi_wakeup_flusher(bdi);
+	spin_unlock_bh(&bdi_lock);
 }
 
 /**
- * writeback_release - relinquish exclusive writeback access against a device.
- * @bdi: the device's backing_dev_info structure
+ * wakeup_flusher_threads - start writeback against all devices
+ * @nr_pages: the number of pages to write on each device, or zero for
+ *	all the dirty pages in the system
  */
-static void writeback_release(struct backing_dev_info *bdi)
+void wakeup_flusher_threads(long nr_pages)
 {
-	BUG_ON(!writeback_in_progress(bdi));
-	clear_bit(BDI_pdflush, &bdi->state);
+	struct backing_dev_info *bdi;
+
+	if (nr_pages == 0)
+		nr_pages = global_page_state(NR_FILE_DIRTY) +
+				global_page_state(NR_UNSTABLE_NFS);
+
+	spin_lock_bh(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (!bdi_has_dirty_io(bdi))
+			continue;
+		bdi_queue_work(bdi, nr_pages);
+		bdi_wakeup_flusher(bdi);
+	}
+	spin_unlock_bh(&bdi_lock);
 }
 
 /**
@@ -71,7 +187,7 @@ static void writeback_release(struct backing_dev_info *bdi)
  *	Mark an inode as dirty. Callers should use mark_inode_dirty or
  *  	mark_inode_dirty_sync.
  *
- * Put the inode on the super block's dirty list.
+ * Put the inode on its backing device's dirty list.
  *
  * CAREFUL! We mark it dirty unconditionally, but move it onto the
  * dirty list only if it is hashed or if it refers to a blockdev.
@@ -141,13 +257,13 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 		/*
 		 * If the inode is being synced, just update its dirty state.
 		 * The unlocker will place the inode on the appropriate
-		 * superblock list, based upon its state.
+		 * backing device list, based upon its state.
 		 */
 		if (inode->i_state & I_SYNC)
 			goto out;
 
 		/*
-		 * Only add valid (hashed) inodes to the superblock's
+		 * Only add valid (hashed) inodes to the backing device's
 		 * dirty list.  Add blockdev inodes as well.
 		 */
 		if (!S_ISBLK(inode->i_mode)) {
@@ -158,12 +274,12 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 			goto out;
 
 		/*
-		 * If the inode was already on s_dirty/s_io/s_more_io, don't
-		 * reposition it (that would break s_dirty time-ordering).
+		 * If the inode was already on b_dirty/b_io/b_more_io, don't
+		 * reposition it (that would break b_dirty time-ordering).
 		 */
 		if (!was_dirty) {
 			inode->dirtied_when = jiffies;
-			list_move(&inode->i_list, &sb->s_dirty);
+			list_move(&inode->i_list, &inode_to_bdi(inode)->b_dirty);
 		}
 	}
 out:
@@ -181,34 +297,34 @@ static int write_inode(struct inode *inode, int sync)
 
 /*
  * Redirty an inode: set its when-it-was dirtied timestamp and move it to the
- * furthest end of its superblock's dirty-inode list.
+ * furthest end of its backing device's dirty-inode list.
  *
  * Before stamping the inode's ->dirtied_when, we check to see whether it is
- * already the most-recently-dirtied inode on the s_dirty list.  If that is
+ * already the most-recently-dirtied inode on the b_dirty list.  If that is
  * the case then the inode must have been redirtied while it was being written
  * out and we don't reset its dirtied_when.
  */
 static void redirty_tail(struct inode *inode)
 {
-	struct super_block *sb = inode->i_sb;
+	struct backing_dev_info *bdi = inode_to_bdi(inode);
 
-	if (!list_empty(&sb->s_dirty)) {
+	if (!list_empty(&bdi->b_dirty)) {
 		struct inode *tail_inode;
 
-		tail_inode = list_entry(sb->s_dirty.next, struct inode, i_list);
+		tail_inode = list_entry(bdi->b_dirty.next, struct inode, i_list);
 		if (!time_after_eq(inode->dirtied_when,
 				tail_inode->dirtied_when))
 			inode->dirtied_when = jiffies;
 	}
-	list_move(&inode->i_list, &sb->s_dirty);
+	list_move(&inode->i_list, &bdi->b_dirty);
 }
 
 /*
- * requeue inode for re-scanning after sb->s_io list is exhausted.
+ * requeue inode for re-scanning after bdi->b_io list is exhausted.
  */
 static void requeue_io(struct inode *inode)
 {
-	list_move(&inode->i_list, &inode->i_sb->s_more_io);
+	list_move(&inode->i_list, &inode_to_bdi(inode)->b_more_io);
 }
 
 static void inode_sync_complete(struct inode *inode)
@@ -240,18 +356,28 @@ static void move_expired_inodes(struct list_head *delaying_queue,
 /*
  * Queue all expired dirty inodes for io, eldest first.
  */
-static void queue_io(struct super_block *sb,
+static void queue_io(struct backing_dev_info *bdi,
 				unsigned long *older_than_this)
 {
-	list_splice_init(&sb->s_more_io, sb->s_io.prev);
-	move_expired_inodes(&sb->s_dirty, &sb->s_io, older_than_this);
+	list_splice_init(&bdi->b_more_io, bdi->b_io.prev);
+	move_expired_inodes(&bdi->b_dirty, &bdi->b_io, older_than_this);
 }
 
 int sb_has_dirty_inodes(struct super_block *sb)
 {
-	return !list_empty(&sb->s_dirty) ||
-	       !list_empty(&sb->s_io) ||
-	       !list_empty(&sb->s_more_io);
+	struct inode *inode;
+	int ret = 0;
+
+	spin_lock(&inode_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		if (inode->i_state & (I_DIRTY|I_SYNC)) {
+			ret = 1;
+			break;
+		}
+	}
+	spin_unlock(&inode_lock);
+
+	return ret;
 }
 EXPORT_SYMBOL(sb_has_dirty_inodes);
 
@@ -307,11 +433,11 @@ __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
 			/*
 			 * We didn't write back all the pages.  nfs_writepages()
 			 * sometimes bales out without doing anything. Redirty
-			 * the inode; Move it from s_io onto s_more_io/s_dirty.
+			 * the inode; Move it from b_io onto b_more_io/b_dirty.
 			 */
 			/*
 			 * akpm: if the caller was the kupdate function we put
-			 * this inode at the head of s_dirty so it gets first
+			 * this inode at the head of b_dirty so it gets first
 			 * consideration.  Otherwise, move it to the tail, for
 			 * the reasons described there.  I'm not really sure
 			 * how much sense this makes.  Presumably I had a good
@@ -321,7 +447,7 @@ __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
 			if (wbc->for_kupdate) {
 				/*
 				 * For the kupdate function we move the inode
-				 * to s_more_io so it will get more writeout as
+				 * to b_more_io so it will get more writeout as
 				 * soon as the queue becomes uncongested.
 				 */
 				inode->i_state |= I_DIRTY_PAGES;
@@ -339,7 +465,7 @@ __sync_single_inode(struct inode *inode, struct writeback_control *wbc)
 			} else {
 				/*
 				 * Otherwise fully redirty the inode so that
-				 * other inodes on this superblock will get some
+				 * other inodes on this device will get some
 				 * writeout.  Otherwise heavy writing to one
 				 * file would indefinitely suspend writeout of
 				 * all the other files.
@@ -387,10 +513,10 @@ __writeback_single_inode(struct inode *inode, struct writeback_control *wbc)
 	if ((wbc->sync_mode != WB_SYNC_ALL) && (inode->i_state & I_SYNC)) {
 		/*
 		 * We're skipping this inode because it's locked, and we're not
-		 * doing writeback-for-data-integrity.  Move it to s_more_io so
-		 * that writeback can proceed with the other inodes on s_io.
+		 * doing writeback-for-data-integrity.  Move it to b_more_io so
+		 * that writeback can proceed with the other inodes on b_io.
 		 * We'll have another go at writing back this inode when we
-		 * completed a full scan of s_io.
+		 * completed a full scan of b_io.
 		 */
 		requeue_io(inode);
 		return 0;
@@ -414,62 +540,69 @@ __writeback_single_inode(struct inode *inode, struct writeback_control *wbc)
 }
 
 /*
- * Write out a superblock's list of dirty inodes.  A wait will be performed
- * upon no inodes, all inodes or the final one, depending upon sync_mode.
+ * Pin the superblock of an inode found on a device's dirty list, so that
+ * it can't be unmounted under us while we write the inode back.  Fails if
+ * the superblock is going away (or coming up): there is no point in
+ * waiting, it will most likely be gone once we'd get it.
+ *
+ * Called under inode_lock.
+ */
+static int pin_sb_for_writeback(struct super_block *sb)
+{
+	spin_lock(&sb_lock);
+	sb->s_count++;
+	if (down_read_trylock(&sb->s_umount)) {
+		if (sb->s_root) {
+			spin_unlock(&sb_lock);
+			return 1;
+		}
+		up_read(&sb->s_umount);
+	}
+	sb->s_count--;
+	spin_unlock(&sb_lock);
+	return 0;
+}
+
+/*
+ * Write out a backing device's list of dirty inodes.
  *
  * If older_than_this is non-NULL, then only write out inodes which
  * had their first dirtying at a time earlier than *older_than_this.
  *
- * If we're a pdlfush thread, then implement pdflush collision avoidance
- * against the entire list.
- *
- * If `bdi' is non-zero then we're being asked to writeback a specific queue.
- * This function assumes that the blockdev superblock's inodes are backed by
- * a variety of queues, so all inodes are searched.  For other superblocks,
- * assume that all inodes are backed by the same queue.
+ * The inodes are normally all backed by @bdi.  Those which are not (a
+ * blockdev inode whose device was opened or closed since it was queued, or
+ * an inode of an unregistered device parked on the default bdi) are written
+ * back all the same, or moved to the right device's lists.
  *
- * FIXME: this linear search could get expensive with many fileystems.  But
- * how to fix?  We need to go from an address_space to all inodes which share
- * a queue with that address_space.  (Easy: have a global "dirty superblocks"
- * list).
- *
- * The inodes to be written are parked on sb->s_io.  They are moved back onto
- * sb->s_dirty as they are selected for writing.  This way, none can be missed
+ * The inodes to be written are parked on bdi->b_io.  They are moved back onto
+ * bdi->b_dirty as they are selected for writing.  This way, none can be missed
  * on the writer throttling path, and we get decent balancing between many
  * throttled threads: we don't want them all piling up on inode_sync_wait.
  */
-void generic_sync_sb_inodes(struct super_block *sb,
-				struct writeback_control *wbc)
+static void writeback_bdi_inodes(struct backing_dev_info *bdi,
+				 struct writeback_control *wbc)
 {
 	const unsigned long start = jiffies;	/* livelock avoidance */
-	int sync = wbc->sync_mode == WB_SYNC_ALL;
 
 	spin_lock(&inode_lock);
-	if (!wbc->for_kupdate || list_empty(&sb->s_io))
-		queue_io(sb, wbc->older_than_this);
+	if (!wbc->for_kupdate || list_empty(&bdi->b_io))
+		queue_io(bdi, wbc->older_than_this);
 
-	while (!list_empty(&sb->s_io)) {
-		struct inode *inode = list_entry(sb->s_io.prev,
+	while (!list_empty(&bdi->b_io)) {
+		struct inode *inode = list_entry(bdi->b_io.prev,
 						struct inode, i_list);
-		struct address_space *mapping = inode->i_mapping;
-		struct backing_dev_info *bdi = mapping->backing_dev_info;
+		struct backing_dev_info *inode_bdi;
+		struct super_block *sb = inode->i_sb;
 		long pages_skipped;
 
-		if (!bdi_cap_writeback_dirty(bdi)) {
-			redirty_tail(inode);
-			if (sb_is_blkdev_sb(sb)) {
-				/*
-				 * Dirty memory-backed blockdev: the ramdisk
-				 * driver does this.  Skip just this inode
-				 */
-				continue;
-			}
+		inode_bdi = inode->i_mapping->backing_dev_info;
+		if (!bdi_cap_writeback_dirty(inode_bdi)) {
 			/*
-			 * Dirty memory-backed inode against a filesystem other
-			 * than the kernel-internal bdev filesystem.  Skip the
-			 * entire superblock.
+			 * Dirty memory-backed inode: the ramdisk driver does
+			 * this for its blockdev.  Nothing to write.
 			 */
-			break;
+			redirty_tail(inode);
+			continue;
 		}
 
 		if (inode->i_state & I_NEW) {
@@ -477,35 +610,27 @@ void generic_sync_sb_inodes(struct super_block *sb,
 			continue;
 		}
 
-		if (wbc->nonblocking && bdi_write_congested(bdi)) {
+		if (wbc->nonblocking && bdi_write_congested(inode_bdi)) {
 			wbc->encountered_congestion = 1;
-			if (!sb_is_blkdev_sb(sb))
-				break;		/* Skip a congested fs */
+			if (inode_bdi == bdi)
+				break;		/* Skip a congested device */
 			requeue_io(inode);
-			continue;		/* Skip a congested blockdev */
-		}
-
-		if (wbc->bdi && bdi != wbc->bdi) {
-			if (!sb_is_blkdev_sb(sb))
-				break;		/* fs has the wrong queue */
-			requeue_io(inode);
-			continue;		/* blockdev has wrong queue */
+			continue;
 		}
 
-		/* Was this inode dirtied after sync_sb_inodes was called? */
+		/* Was this inode dirtied after writeback_bdi_inodes was called? */
 		if (time_after(inode->dirtied_when, start))
 			break;
 
-		/* Is another pdflush already flushing this queue? */
-		if (current_is_pdflush() && !writeback_acquire(bdi))
-			break;
+		if (!pin_sb_for_writeback(sb)) {
+			requeue_io(inode);
+			continue;
+		}
 
 		BUG_ON(inode->i_state & I_FREEING);
 		__iget(inode);
 		pages_skipped = wbc->pages_skipped;
 		__writeback_single_inode(inode, wbc);
-		if (current_is_pdflush())
-			writeback_release(bdi);
 		if (wbc->pages_skipped != pages_skipped) {
 			/*
 			 * writeback is not making progress due to locked
@@ -515,18 +640,257 @@ void generic_sync_sb_inodes(struct super_block *sb,
 		}
 		spin_unlock(&inode_lock);
 		iput(inode);
+		drop_super(sb);
 		cond_resched();
 		spin_lock(&inode_lock);
 		if (wbc->nr_to_write <= 0) {
 			wbc->more_io = 1;
 			break;
 		}
-		if (!list_empty(&sb->s_more_io))
+		if (!list_empty(&bdi->b_more_io))
+			wbc->more_io = 1;
+	}
+	spin_unlock(&inode_lock);
+	/* Leave any unwritten inodes on b_io */
+}
+
+static int over_bground_thresh(void)
+{
+	unsigned long background_thresh, dirty_thresh;
+
+	get_dirty_limits(&background_thresh, &dirty_thresh, NULL, NULL);
+
+	return (global_page_state(NR_FILE_DIRTY) +
+		global_page_state(NR_UNSTABLE_NFS) >= background_thresh);
+}
+
+/*
+ * Write back at least nr_pages of a device in MAX_WRITEBACK_PAGES chunks.
+ *
+ * A request from the queue keeps writing until the amount of dirty memory
+ * is less than the background threshold, or until the device is clean.
+ *
+ * A kupdate style flush only writes "old" data: the first time one of an
+ * inode's pages is dirtied, we mark the dirtying-time in the inode, and
+ * inodes older than dirty_expire_interval are written back.  older_than_this
+ * takes precedence over nr_pages, so we'll only write back all dirty pages
+ * if they are all attached to "old" mappings.
+ *
+ * Returns the number of pages written.
+ */
+static long wb_writeback(struct backing_dev_info *bdi, long nr_pages,
+			 int for_kupdate)
+{
+	unsigned long oldest_jif;
+	long wrote = 0;
+	struct writeback_control wbc = {
+		.bdi		= bdi,
+		.sync_mode	= WB_SYNC_NONE,
+		.older_than_this = NULL,
+		.nonblocking	= 1,
+		.for_kupdate	= for_kupdate,
+		.range_cyclic	= 1,
+	};
+
+	if (for_kupdate) {
+		oldest_jif = jiffies - dirty_expire_interval;
+		wbc.older_than_this = &oldest_jif;
+	}
+
+	for (;;) {
+		if (nr_pages <= 0 && (for_kupdate || !over_bground_thresh()))
+			break;
+
+		wbc.more_io = 0;
+		wbc.encountered_congestion = 0;
+		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
+		wbc.pages_skipped = 0;
+		writeback_bdi_inodes(bdi, &wbc);
+		nr_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
+		wrote += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
+
+		if (wbc.nr_to_write > 0 || wbc.pages_skipped > 0) {
+			/* Wrote less than expected */
+			if (wbc.encountered_congestion || wbc.more_io)
+				congestion_wait(WRITE, HZ/10);
+			else
+				break;
+		}
+	}
+
+	return wrote;
+}
+
+static struct bdi_work *get_next_work_item(struct backing_dev_info *bdi)
+{
+	struct bdi_work *work = NULL;
+
+	spin_lock_bh(&bdi->wb_lock);
+	if (!list_empty(&bdi->work_list)) {
+		work = list_entry(bdi->work_list.next, struct bdi_work, list);
+		list_del(&work->list);
+	}
+	spin_unlock_bh(&bdi->wb_lock);
+
+	return work;
+}
+
+/*
+ * Periodic writeback of "old" data, once per dirty_writeback_interval.
+ */
+static long wb_check_old_data_flush(struct backing_dev_info *bdi)
+{
+	long nr_pages;
+
+	if (!dirty_writeback_interval ||
+	    time_before(jiffies, bdi->last_old_flush + dirty_writeback_interval))
+		return 0;
+
+	bdi->last_old_flush = jiffies;
+	nr_pages = global_page_state(NR_FILE_DIRTY) +
+			global_page_state(NR_UNSTABLE_NFS) +
+			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+
+	return wb_writeback(bdi, nr_pages, 1);
+}
+
+/*
+ * Run the queued writeback requests of a device, then its periodic flush.
+ * Returns the number of pages written.
+ */
+long wb_do_writeback(struct backing_dev_info *bdi)
+{
+	struct bdi_work *work;
+	long wrote = 0;
+
+	set_bit(BDI_writeback_running, &bdi->state);
+
+	while ((work = get_next_work_item(bdi)) != NULL) {
+		wrote += wb_writeback(bdi, work->nr_pages, 0);
+		kfree(work);
+	}
+	wrote += wb_check_old_data_flush(bdi);
+
+	clear_bit(BDI_writeback_running, &bdi->state);
+
+	return wrote;
+}
+
+/*
+ * Let an idle flusher thread go: it only exits if nobody took it over for
+ * a kthread_stop() and there is nothing left for it to do.
+ */
+static int bdi_retire_flusher(struct backing_dev_info *bdi)
+{
+	int ret = 0;
+
+	spin_lock_bh(&bdi_lock);
+	if (bdi->task == current && list_empty(&bdi->work_list) &&
+	    !bdi_has_dirty_io(bdi)) {
+		bdi->task = NULL;
+		ret = 1;
+	}
+	spin_unlock_bh(&bdi_lock);
+
+	return ret;
+}
+
+/*
+ * The flusher thread of a backing device, forked by the default bdi's
+ * thread when the device has dirty data.  It writes back the device on
+ * request and periodically, and exits once it has been idle for a while.
+ */
+int bdi_writeback_task(struct backing_dev_info *bdi)
+{
+	unsigned long last_active = jiffies;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+	set_freezable();
+	bdi->last_old_flush = jiffies;
+
+	while (!kthread_should_stop()) {
+		if (wb_do_writeback(bdi))
+			last_active = jiffies;
+		else if (time_after(jiffies, last_active + FLUSHER_IDLE_TIMEOUT) &&
+			 bdi_retire_flusher(bdi))
+			break;
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!list_empty(&bdi->work_list) || kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+
+		if (dirty_writeback_interval)
+			schedule_timeout(dirty_writeback_interval);
+		else
+			schedule();
+
+		try_to_freeze();
+	}
+
+	return 0;
+}
+
+/*
+ * Write out a superblock's dirty inodes.  A wait will be performed upon no
+ * inodes or all inodes, depending upon sync_mode.
+ *
+ * The dirty inodes sit on the lists of their backing devices, which may
+ * hold the inodes of other superblocks too, so walk the superblock's own
+ * inode list for them instead.  The caller holds a reference on @sb.
+ */
+void generic_sync_sb_inodes(struct super_block *sb,
+				struct writeback_control *wbc)
+{
+	const unsigned long start = jiffies;	/* livelock avoidance */
+	int sync = wbc->sync_mode == WB_SYNC_ALL;
+	struct inode *inode, *old_inode = NULL;
+
+	spin_lock(&inode_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		long pages_skipped;
+
+		if (!(inode->i_state & (I_DIRTY|I_SYNC)))
+			continue;
+		if (inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW))
+			continue;
+		if (!mapping_cap_writeback_dirty(inode->i_mapping))
+			continue;
+
+		/* Was this inode dirtied after we were called? */
+		if (time_after(inode->dirtied_when, start))
+			continue;
+		if (wbc->older_than_this &&
+		    time_after(inode->dirtied_when, *wbc->older_than_this))
+			continue;
+
+		__iget(inode);
+		pages_skipped = wbc->pages_skipped;
+		__writeback_single_inode(inode, wbc);
+		if (wbc->pages_skipped != pages_skipped)
+			redirty_tail(inode);
+		spin_unlock(&inode_lock);
+		/*
+		 * We hold a reference to 'inode' so it couldn't have been
+		 * removed from s_inodes list while we dropped the inode_lock.
+		 * See below for why the previous one is only put now.
+		 */
+		iput(old_inode);
+		old_inode = inode;
+		cond_resched();
+		spin_lock(&inode_lock);
+		if (wbc->nr_to_write <= 0) {
 			wbc->more_io = 1;
+			break;
+		}
 	}
+	spin_unlock(&inode_lock);
+	iput(old_inode);
 
 	if (sync) {
-		struct inode *inode, *old_inode = NULL;
+		old_inode = NULL;
+		spin_lock(&inode_lock);
 
 		/*
 		 * Data integrity sync. Must wait for all pages under writeback,
@@ -564,10 +928,7 @@ void generic_sync_sb_inodes(struct super_block *sb,
 		}
 		spin_unlock(&inode_lock);
 		iput(old_inode);
-	} else
-		spin_unlock(&inode_lock);
-
-	return;		/* Leave any unwritten inodes on s_io */
+	}
 }
 EXPORT_SYMBOL_GPL(generic_sync_sb_inodes);
 
@@ -577,58 +938,6 @@ static void sync_sb_inodes(struct super_block *sb,
 	generic_sync_sb_inodes(sb, wbc);
 }
 
-/*
- * Start writeback of dirty pagecache data against all unlocked inodes.
- *
- * Note:
- * We don't need to grab a reference to superblock here. If it has non-empty
- * ->s_dirty it's hadn't been killed yet and kill_super() won't proceed
- * past sync_inodes_sb() until the ->s_dirty/s_io/s_more_io lists are all
- * empty. Since __sync_single_inode() regains inode_lock before it finally moves
- * inode from superblock lists we are OK.
- *
- * If `older_than_this' is non-zero then only flush inodes which have a
- * flushtime older than *older_than_this.
- *
- * If `bdi' is non-zero then we will scan the first inode against each
- * superblock until we find the matching ones.  One group will be the dirty
- * inodes against a filesystem.  Then when we hit the dummy blockdev superblock,
- * sync_sb_inodes will seekout the blockdev which matches `bdi'.  Maybe not
- * super-efficient but we're about to do a ton of I/O...
- */
-void
-writeback_inodes(struct writeback_control *wbc)
-{
-	struct super_block *sb;
-
-	might_sleep();
-	spin_lock(&sb_lock);
-restart:
-	list_for_each_entry_reverse(sb, &super_blocks, s_list) {
-		if (sb_has_dirty_inodes(sb)) {
-			/* we're making our own get_super here */
-			sb->s_count++;
-			spin_unlock(&sb_lock);
-			/*
-			 * If we can't get the readlock, there's no sense in
-			 * waiting around, most of the time the FS is going to
-			 * be unmounted by the time it is released.
-			 */
-			if (down_read_trylock(&sb->s_umount)) {
-				if (sb->s_root)
-					sync_sb_inodes(sb, wbc);
-				up_read(&sb->s_umount);
-			}
-			spin_lock(&sb_lock);
-			if (__put_super_and_need_restart(sb))
-				goto restart;
-		}
-		if (wbc->nr_to_write <= 0)
-			break;
-	}
-	spin_unlock(&sb_lock);
-}
-
 /*
  * writeback and wait upon the filesystem's dirty inodes.  The caller will
  * do this in two passes - one to write, and one to wait.
@@ -663,7 +972,7 @@ void sync_inodes_sb(struct super_block *sb, int wait)
  * sync_inodes - writes all inodes to disk
  * @wait: wait for completion
  *
- * sync_inodes() goes through each super block's dirty inode list, writes the
+ * sync_inodes() goes through each super block's dirty inodes, writes the
  * inodes out, waits on the writeout and puts the inodes back on the normal
  * list.
  *
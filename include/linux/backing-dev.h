@@ -18,12 +18,15 @@
 struct page;
 struct device;
 struct dentry;
+struct task_struct;
 
 /*
  * Bits in backing_dev_info.state
  */
 enum bdi_state {
-	BDI_pdflush,		/* A pdflush thread is working this device */
+	BDI_pending,		/* A flusher thread is being forked for it */
+	BDI_writeback_running,	/* The flusher thread is writing back */
+	BDI_registered,		/* bdi_register() was done */
 	BDI_write_congested,	/* The write queue is getting full */
 	BDI_read_congested,	/* The read queue is getting full */
 	BDI_unused,		/* Available bits start here */
@@ -56,6 +59,20 @@ struct backing_dev_info {
 	unsigned int min_ratio;
 	unsigned int max_ratio, max_prop_frac;
 
+	/*
+	 * Writeback: dirty inodes against this device, and the flusher
+	 * thread writing them back.  The inode lists are protected by
+	 * inode_lock, the task pointer by bdi_lock.
+	 */
+	struct list_head bdi_list;	/* on the global bdi_list */
+	struct task_struct *task;	/* flusher thread, NULL while idle */
+	unsigned long last_old_flush;	/* last kupdate style flush */
+	struct list_head b_dirty;	/* dirty inodes */
+	struct list_head b_io;		/* parked for writeback */
+	struct list_head b_more_io;	/* parked for more writeback */
+	spinlock_t wb_lock;		/* protects work_list */
+	struct list_head work_list;	/* writeback requests, see fs-writeback.c */
+
 	struct device *dev;
 
 #ifdef CONFIG_DEBUG_FS
@@ -71,6 +88,14 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 		const char *fmt, ...);
 int bdi_register_dev(struct backing_dev_info *bdi, dev_t dev);
 void bdi_unregister(struct backing_dev_info *bdi);
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages);
+int bdi_writeback_task(struct backing_dev_info *bdi);
+long wb_do_writeback(struct backing_dev_info *bdi);
+int bdi_has_dirty_io(struct backing_dev_info *bdi);
+void bdi_wakeup_flushers(void);
+
+extern spinlock_t bdi_lock;
+extern struct list_head bdi_list;
 
 static inline void __add_bdi_stat(struct backing_dev_info *bdi,
 		enum bdi_stat_item item, s64 amount)
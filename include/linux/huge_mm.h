@@ -0,0 +1,148 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages: anonymous memory mapped by a single pmd.
+ * See mm/huge_memory.c and Documentation/vm/transhuge.txt.
+ */
+
+struct mmu_gather;
+
+enum transparent_hugepage_flag {
+	TRANSPARENT_HUGEPAGE_FLAG,
+	TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
+};
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+#define HPAGE_PMD_SHIFT PMD_SHIFT
+#define HPAGE_PMD_SIZE	((1UL) << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK	(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER	(HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR	(1 << HPAGE_PMD_ORDER)
+
+extern unsigned long transparent_hugepage_flags;
+
+/* vmas that can never be backed by a huge pmd */
+#define VM_NO_THP (VM_SHARED | VM_MAYSHARE | VM_PFNMAP | VM_IO | VM_HUGETLB | \
+		   VM_MIXEDMAP | VM_INSERTPAGE | VM_LOCKED | VM_NONLINEAR | \
+		   VM_GROWSDOWN | VM_GROWSUP | VM_NOHUGEPAGE)
+
+static inline int transparent_hugepage_suitable(struct vm_area_struct *vma)
+{
+	if (vma->vm_ops || vma->vm_file || (vma->vm_flags & VM_NO_THP))
+		return 0;
+	if (transparent_hugepage_flags & (1 << TRANSPARENT_HUGEPAGE_FLAG))
+		return 1;
+	if (transparent_hugepage_flags &
+	    (1 << TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG))
+		return !!(vma->vm_flags & VM_HUGEPAGE);
+	return 0;
+}
+
+/* Can a huge pmd be installed at @haddr (HPAGE_PMD_SIZE aligned) in @vma? */
+static inline int transparent_hugepage_fits(struct vm_area_struct *vma,
+					    unsigned long haddr)
+{
+	return haddr >= vma->vm_start && haddr + HPAGE_PMD_SIZE <= vma->vm_end;
+}
+
+static inline int PageTransHuge(struct page *page)
+{
+	VM_BUG_ON(PageTail(page));
+	return PageHead(page);
+}
+
+static inline int hpage_nr_pages(struct page *page)
+{
+	if (unlikely(PageTransHuge(page)))
+		return HPAGE_PMD_NR;
+	return 1;
+}
+
+extern int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+				      struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd,
+				      int write_access);
+extern int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+			pmd_t *pmd);
+extern pmd_t *page_check_address_pmd(struct page *page, struct mm_struct *mm,
+				     unsigned long address);
+
+extern int split_huge_page(struct page *page);
+extern void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd);
+#define split_huge_page_pmd(__mm, __pmd)				\
+	do {								\
+		pmd_t *____pmd = (__pmd);				\
+		while (unlikely(pmd_trans_huge(*____pmd)))		\
+			__split_huge_page_pmd(__mm, ____pmd);		\
+	} while (0)
+/*
+ * A pmd being split stays pmd_trans_huge(), marked pmd_trans_splitting(),
+ * until its pte table is installed, all under the page_table_lock: taking
+ * the lock is enough to wait for the split to finish.
+ */
+#define wait_split_huge_page(__mm, __pmd)				\
+	do {								\
+		spin_lock(&(__mm)->page_table_lock);			\
+		spin_unlock(&(__mm)->page_table_lock);			\
+	} while (0)
+extern void vma_adjust_trans_huge(struct vm_area_struct *vma,
+				  unsigned long start, unsigned long end,
+				  long adjust_next);
+extern int hugepage_madvise(struct vm_area_struct *vma,
+			    unsigned long *vm_flags, int advice);
+
+#else /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define HPAGE_PMD_SHIFT ({ BUG(); 0; })
+#define HPAGE_PMD_MASK ({ BUG(); 0; })
+#define HPAGE_PMD_SIZE ({ BUG(); 0; })
+#define HPAGE_PMD_NR ({ BUG(); 0; })
+
+#define transparent_hugepage_suitable(__vma) 0
+#define transparent_hugepage_fits(__vma, __haddr) 0
+#define PageTransHuge(page) 0
+#define hpage_nr_pages(page) 1
+#define page_check_address_pmd(__page, __mm, __address) NULL
+
+static inline int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+					     struct vm_area_struct *vma,
+					     unsigned long address, pmd_t *pmd,
+					     int write_access)
+{
+	return VM_FAULT_FALLBACK;
+}
+
+static inline int zap_huge_pmd(struct mmu_gather *tlb,
+			       struct vm_area_struct *vma, pmd_t *pmd)
+{
+	return 0;
+}
+
+static inline int split_huge_page(struct page *page)
+{
+	return 0;
+}
+#define split_huge_page_pmd(__mm, __pmd) do { } while (0)
+#define wait_split_huge_page(__mm, __pmd) do { } while (0)
+
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+}
+
+static inline int hugepage_madvise(struct vm_area_struct *vma,
+				   unsigned long *vm_flags, int advice)
+{
+	return -EINVAL;
+}
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
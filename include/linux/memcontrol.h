@@ -39,6 +39,9 @@ struct mm_struct;
 
 extern int mem_cgroup_newpage_charge(struct page *page, struct mm_struct *mm,
 				gfp_t gfp_mask);
+extern int mem_cgroup_charge_huge(struct page *page, int nr,
+				struct mm_struct *mm, gfp_t gfp_mask);
+extern void mem_cgroup_uncharge_tails(struct page *page, int nr);
 /* for swap handling */
 extern int mem_cgroup_try_charge_swapin(struct mm_struct *mm,
 		struct page *page, gfp_t mask, struct mem_cgroup **ptr);
@@ -127,6 +130,16 @@ static inline int mem_cgroup_newpage_charge(struct page *page,
 	return 0;
 }
 
+static inline int mem_cgroup_charge_huge(struct page *page, int nr,
+					struct mm_struct *mm, gfp_t gfp_mask)
+{
+	return 0;
+}
+
+static inline void mem_cgroup_uncharge_tails(struct page *page, int nr)
+{
+}
+
 static inline int mem_cgroup_cache_charge(struct page *page,
 					struct mm_struct *mm, gfp_t gfp_mask)
 {
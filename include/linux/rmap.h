@@ -63,6 +63,10 @@ void anon_vma_unlink(struct vm_area_struct *);
 void anon_vma_link(struct vm_area_struct *);
 void __anon_vma_link(struct vm_area_struct *);
 
+struct anon_vma *page_lock_anon_vma(struct page *page);
+void page_unlock_anon_vma(struct anon_vma *anon_vma);
+unsigned long vma_address(struct page *page, struct vm_area_struct *vma);
+
 /*
  * rmap interfaces called when adding or removing pte of page
  */
@@ -96,6 +96,7 @@ enum {
 #define TCP_QUICKACK		12	/* Block/reenable quick acks */
 #define TCP_CONGESTION		13	/* Congestion control algorithm */
 #define TCP_MD5SIG		14	/* TCP MD5 Signature (RFC2385) */
+#define TCP_FASTOPEN		15	/* Enable Fast Open on listeners */
 
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
@@ -238,6 +239,8 @@ struct tcp_request_sock {
 #endif
 	u32			 	rcv_isn;
 	u32			 	snt_isn;
+	u16				syn_data_len;	/* Fast Open data acked in SYN-ACK */
+	u8				fastopen_cookie; /* SYN-ACK carries a cookie */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -409,6 +412,24 @@ struct tcp_sock {
 #endif
 
 	int			linger2;
+
+/* TCP Fast Open */
+	struct tcp_fastopen_request *fastopen_req; /* active open with data */
+	struct request_sock	*fastopen_rsk;	/* passive open: resent as SYN-ACK
+						 * until the handshake completes */
+	int			fastopen_qlen;	/* TCP_FASTOPEN limit on a listener */
+	u8			syn_fastopen:1,	/* SYN carried a Fast Open option */
+				syn_data:1;	/* SYN carried data */
+
+/* TCP Small Queues: skbs below the socket, see tcp_wfree() */
+	unsigned long		tsq_flags;
+	struct list_head	tsq_node;	/* on the per-cpu tsq list */
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,		/* tcp_write_xmit() stopped at the limit */
+	TSQ_QUEUED,		/* on the per-cpu tsq list */
+	TCP_TSQ_DEFERRED,	/* tasklet found the socket owned by user */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
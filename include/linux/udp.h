@@ -78,6 +78,12 @@ struct udp_sock {
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+	/*
+	 * Route of the last unconnected IPv4 send, reused by the next one
+	 * to the same destination.  Protected by sk_dst_lock.
+	 */
+	struct dst_entry *last_dst;
+	unsigned int	 last_dst_genid;
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -27,6 +27,8 @@ struct inet_peer
 	atomic_t		rid;		/* Frag reception counter */
 	__u32			tcp_ts;
 	unsigned long		tcp_ts_stamp;
+	__u8			tcp_fastopen_cookie_len;
+	__u8			tcp_fastopen_cookie[16];
 };
 
 void			inet_initpeers(void) __init;
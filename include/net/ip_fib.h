@@ -44,6 +44,29 @@ struct fib_config {
  };
 
 struct fib_info;
+struct rtable;
+
+/*
+ * Things learnt about a single destination reached through a nexthop:
+ * the path MTU from ICMP "fragmentation needed" and a better first hop
+ * from ICMP redirects.  They are applied to routes built for it.
+ */
+struct fib_nh_exception {
+	struct fib_nh_exception		*fnhe_next;
+	__be32				fnhe_daddr;
+	u32				fnhe_pmtu;
+	int				fnhe_mtu_locked;
+	__be32				fnhe_gw;
+	unsigned long			fnhe_expires;
+	unsigned long			fnhe_stamp;
+};
+
+struct fnhe_hash_bucket {
+	struct fib_nh_exception		*chain;
+};
+
+#define FNHE_HASH_SIZE		2048
+#define FNHE_RECLAIM_DEPTH	5
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -60,6 +83,7 @@ struct fib_nh {
 #endif
 	int			nh_oif;
 	__be32			nh_gw;
+	struct fnhe_hash_bucket	*nh_exceptions;
 };
 
 /*
@@ -82,6 +106,8 @@ struct fib_info {
 #define fib_window fib_metrics[RTAX_WINDOW-1]
 #define fib_rtt fib_metrics[RTAX_RTT-1]
 #define fib_advmss fib_metrics[RTAX_ADVMSS-1]
+	struct rtable		**fib_rth_input;
+	struct rtable		**fib_rth_output;
 	int			fib_nhs;
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 	int			fib_power;
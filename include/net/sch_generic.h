@@ -45,6 +45,8 @@ struct Qdisc
 #define TCQ_F_BUILTIN	1
 #define TCQ_F_THROTTLED	2
 #define TCQ_F_INGRESS	4
+#define TCQ_F_CAN_BYPASS	8	/* work conserving, may xmit directly when empty */
+#define TCQ_F_ONETXQUEUE	16	/* feeds a single tx queue, may bulk dequeue */
 	int			padded;
 	struct Qdisc_ops	*ops;
 	struct qdisc_size_table	*stab;
@@ -70,6 +72,9 @@ struct Qdisc
 	 * and it will live until better solution will be invented.
 	 */
 	struct Qdisc		*__parent;
+
+	/* serializes contended enqueuers ahead of the root lock */
+	spinlock_t		busylock;
 };
 
 struct Qdisc_class_ops
@@ -166,6 +166,7 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOPT_SACK             5       /* SACK Block */
 #define TCPOPT_TIMESTAMP	8	/* Better RTT estimations/PAWS */
 #define TCPOPT_MD5SIG		19	/* MD5 Signature (RFC2385) */
+#define TCPOPT_FASTOPEN		34	/* Fast open (RFC7413) */
 
 /*
  *     TCP option lengths
@@ -176,6 +177,7 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOLEN_SACK_PERM      2
 #define TCPOLEN_TIMESTAMP      10
 #define TCPOLEN_MD5SIG         18
+#define TCPOLEN_FASTOPEN_BASE  2
 
 /* But this is what stacks really send out. */
 #define TCPOLEN_TSTAMP_ALIGNED		12
@@ -236,6 +238,8 @@ extern int sysctl_tcp_base_mss;
 extern int sysctl_tcp_workaround_signed_windows;
 extern int sysctl_tcp_slow_start_after_idle;
 extern int sysctl_tcp_max_ssthresh;
+extern int sysctl_tcp_fastopen;
+extern int sysctl_tcp_limit_output_bytes;
 
 extern atomic_t tcp_memory_allocated;
 extern struct percpu_counter tcp_sockets_allocated;
@@ -393,9 +397,12 @@ extern int			tcp_recvmsg(struct kiocb *iocb, struct sock *sk,
 					    size_t len, int nonblock, 
 					    int flags, int *addr_len);
 
+struct tcp_fastopen_cookie;
+
 extern void			tcp_parse_options(struct sk_buff *skb,
 						  struct tcp_options_received *opt_rx,
-						  int estab);
+						  int estab,
+						  struct tcp_fastopen_cookie *foc);
 
 extern u8			*tcp_parse_md5sig_option(struct tcphdr *th);
 
@@ -431,6 +438,10 @@ extern struct sk_buff *		tcp_make_synack(struct sock *sk,
 						struct dst_entry *dst,
 						struct request_sock *req);
 
+extern void			tcp_openreq_init_rwin(struct request_sock *req,
+						      struct sock *sk,
+						      struct dst_entry *dst);
+
 extern int			tcp_disconnect(struct sock *sk, int flags);
 
 
@@ -469,6 +480,9 @@ extern int  tcp_send_synack(struct sock *);
 extern void tcp_push_one(struct sock *, unsigned int mss_now);
 extern void tcp_send_ack(struct sock *sk);
 extern void tcp_send_delayed_ack(struct sock *sk);
+extern void tcp_wfree(struct sk_buff *skb);
+extern void tcp_release_cb(struct sock *sk);
+extern void tcp_tasklet_init(void);
 
 /* tcp_input.c */
 extern void tcp_cwnd_application_limited(struct sock *sk);
@@ -962,6 +976,8 @@ static inline void tcp_openreq_init(struct request_sock *req,
 	req->rcv_wnd = 0;		/* So that tcp_send_synack() knows! */
 	req->cookie_ts = 0;
 	tcp_rsk(req)->rcv_isn = TCP_SKB_CB(skb)->seq;
+	tcp_rsk(req)->syn_data_len = 0;
+	tcp_rsk(req)->fastopen_cookie = 0;
 	req->mss = rx_opt->mss_clamp;
 	req->ts_recent = rx_opt->saw_tstamp ? rx_opt->rcv_tsval : 0;
 	ireq->tstamp_ok = rx_opt->tstamp_ok;
@@ -1400,4 +1416,54 @@ struct tcp_request_sock_ops {
 extern void tcp_v4_init(void);
 extern void tcp_init(void);
 
+/*
+ * TCP Fast Open (RFC 7413): data carried in the SYN is delivered to the
+ * listener before the three way handshake completes, provided the SYN
+ * carries a cookie the server handed out on an earlier connection.
+ */
+#define TFO_CLIENT_ENABLE	1	/* sysctl_tcp_fastopen bits */
+#define TFO_SERVER_ENABLE	2
+
+#define TCP_FASTOPEN_COOKIE_MIN		4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX		16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE	8	/* the size employed by this impl. */
+
+/* A cookie of len 0 is a cookie request, len < 0 means no option seen */
+struct tcp_fastopen_cookie {
+	s8	len;
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+};
+
+/* Active open with data, alive for the duration of the connect() */
+struct tcp_fastopen_request {
+	struct tcp_fastopen_cookie	cookie;
+	struct msghdr			*data;
+	size_t				size;
+	int				copied;	/* bytes sent in the SYN */
+};
+
+extern void tcp_fastopen_cookie_gen(__be32 addr,
+				    struct tcp_fastopen_cookie *foc);
+extern void tcp_fastopen_cache_get(struct sock *sk,
+				   struct tcp_fastopen_cookie *cookie);
+extern void tcp_fastopen_cache_set(struct sock *sk,
+				   struct tcp_fastopen_cookie *cookie);
+extern void tcp_fastopen_synack_acked(struct sock *sk);
+
+static inline void tcp_free_fastopen_req(struct tcp_sock *tp)
+{
+	if (tp->fastopen_req != NULL) {
+		kfree(tp->fastopen_req);
+		tp->fastopen_req = NULL;
+	}
+}
+
+static inline void tcp_free_fastopen_rsk(struct tcp_sock *tp)
+{
+	if (tp->fastopen_rsk != NULL) {
+		reqsk_free(tp->fastopen_rsk);
+		tp->fastopen_rsk = NULL;
+	}
+}
+
 #endif	/* _TCP_H */
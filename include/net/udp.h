@@ -119,6 +119,13 @@ static inline void udp_lib_hash(struct sock *sk)
 
 extern void udp_lib_unhash(struct sock *sk);
 
+/* Drop the route udp_sendmsg() keeps for unconnected sends. */
+static inline void udp_lib_release_dst(struct sock *sk)
+{
+	dst_release(udp_sk(sk)->last_dst);
+	udp_sk(sk)->last_dst = NULL;
+}
+
 static inline void udp_lib_close(struct sock *sk, long timeout)
 {
 	sk_common_release(sk);
@@ -0,0 +1,514 @@
+/*
+ * Testsuite for the socket filter interpreter and JIT compiler
+ *
+ * Every test program is run on a linear skb and, where it makes sense,
+ * on an skb whose data is mostly held in a page fragment, first with
+ * sk_run_filter() and then through &sk_filter.bpf_func, which points to
+ * the native image when the JIT accepted the program.  Both results
+ * must match the expected value.
+ *
+ * Set net.core.bpf_jit_enable to 1 before loading this module to
+ * exercise the JIT compiler as well as the interpreter.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/slab.h>
+
+#define MAX_INSNS	16
+#define MAX_DATA	32
+
+/* flags selecting the skb layouts a test is run on */
+#define SKB_LINEAR	1
+#define SKB_FRAG	2
+#define SKB_BOTH	(SKB_LINEAR | SKB_FRAG)
+
+/* number of bytes kept in the linear part of a SKB_FRAG buffer */
+#define SKB_FRAG_HEADLEN	4
+
+struct bpf_test {
+	const char *descr;
+	struct sock_filter insns[MAX_INSNS];
+	int flags;
+	int data_size;
+	unsigned char data[MAX_DATA];
+	unsigned int result;
+};
+
+#define PKT_DATA							\
+	16, { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,		\
+	      0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10 }
+
+static struct bpf_test tests[] = {
+	{
+		"RET_K",
+		{
+			BPF_STMT(BPF_RET | BPF_K, 42),
+		},
+		SKB_LINEAR, PKT_DATA, 42
+	},
+	{
+		"LD_IMM / RET_A",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 7),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 7
+	},
+	{
+		"A starts at zero",
+		{
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 3),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 3
+	},
+	{
+		"ALU ADD/SUB K",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 10),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 5),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 3),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 0x10000),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 0x100),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 0xffffffff),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 0xff0b
+	},
+	{
+		"ALU ADD/SUB X",
+		{
+			BPF_STMT(BPF_LDX | BPF_IMM, 4),
+			BPF_STMT(BPF_LD | BPF_IMM, 10),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 14
+	},
+	{
+		"ALU MUL K/X",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 3),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 1000),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2),
+			BPF_STMT(BPF_LDX | BPF_IMM, 3),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 18000
+	},
+	{
+		"ALU DIV K/X",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0xffffffff),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 3),
+			BPF_STMT(BPF_LDX | BPF_IMM, 5),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 0x11111111
+	},
+	{
+		"ALU DIV X by zero",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 10),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		SKB_LINEAR, PKT_DATA, 0
+	},
+	{
+		"ALU AND/OR K/X",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0x12345678),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffffff0f),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff0fff),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x00ffffff),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_K, 0x1),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_K, 0x80000000),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0xff00ff0f),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0x00200000),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 0x80200609
+	},
+	{
+		"ALU LSH/RSH K/X",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 4),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 1),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 2),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 1),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 2),
+			BPF_STMT(BPF_LDX | BPF_IMM, 1),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 8
+	},
+	{
+		"ALU NEG",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 5),
+			BPF_STMT(BPF_ALU | BPF_NEG, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 0xfffffffb
+	},
+	{
+		"MISC TAX/TXA",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 9),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0),
+			BPF_STMT(BPF_MISC | BPF_TXA, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 9
+	},
+	{
+		"ST/STX and LD/LDX MEM",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 11),
+			BPF_STMT(BPF_ST, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 22),
+			BPF_STMT(BPF_ST, BPF_MEMWORDS - 1),
+			BPF_STMT(BPF_LDX | BPF_MEM, 0),
+			BPF_STMT(BPF_LD | BPF_MEM, BPF_MEMWORDS - 1),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_ST, 1),
+			BPF_STMT(BPF_STX, 3),
+			BPF_STMT(BPF_LD | BPF_MEM, 3),
+			BPF_STMT(BPF_LDX | BPF_MEM, 1),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 44
+	},
+	{
+		"LD/LDX LEN",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+			BPF_STMT(BPF_LDX | BPF_W | BPF_LEN, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_BOTH, PKT_DATA, 32
+	},
+	{
+		"LD ABS W/H/B",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 12),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_BOTH, PKT_DATA, 0x0e101721
+	},
+	{
+		"LD IND W/H/B",
+		{
+			BPF_STMT(BPF_LDX | BPF_IMM, 2),
+			BPF_STMT(BPF_LD | BPF_W | BPF_IND, 0),
+			BPF_STMT(BPF_ST, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),
+			BPF_STMT(BPF_ST, 1),
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8),
+			BPF_STMT(BPF_LDX | BPF_MEM, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_MEM, 1),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_BOTH, PKT_DATA, 0x03040c19
+	},
+	{
+		"LD ABS past the end",
+		{
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 15),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		SKB_BOTH, PKT_DATA, 0
+	},
+	{
+		"LD IND past the end",
+		{
+			BPF_STMT(BPF_LDX | BPF_IMM, 200),
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		SKB_BOTH, PKT_DATA, 0
+	},
+	{
+		"LD IND negative offset",
+		{
+			BPF_STMT(BPF_LDX | BPF_IMM, 1),
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, SKF_NET_OFF),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 3),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 0x06
+	},
+	{
+		"LDX MSH",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0x77),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 8),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_BOTH, 16,
+		{ 0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		  0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		0x77 + 20 + 60
+	},
+	{
+		"LD ABS ancillary protocol",
+		{
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_PROTOCOL),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		SKB_LINEAR, PKT_DATA, ETH_P_IP
+	},
+	{
+		"JMP JA",
+		{
+			BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		SKB_LINEAR, PKT_DATA, 1
+	},
+	{
+		"JMP JEQ/JGT/JGE K",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 10),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 10, 0, 5),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 9, 0, 4),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 10, 0, 3),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 10, 2, 0),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 1000, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 1
+	},
+	{
+		"JMP JSET K",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0x1234),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x4, 0, 5),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x200, 0, 4),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x10000, 3, 0),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x0c00, 2, 0),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x1234, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 1
+	},
+	{
+		"JMP JEQ/JGT/JGE/JSET X",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 10),
+			BPF_STMT(BPF_LDX | BPF_IMM, 10),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, 0, 5),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 0, 4),
+			BPF_STMT(BPF_LDX | BPF_IMM, 3),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 0, 2),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_X, 0, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		SKB_LINEAR, PKT_DATA, 1
+	},
+	{
+		"JMP with identical targets",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 2, 0, 0),
+			BPF_STMT(BPF_RET | BPF_K, 5),
+		},
+		SKB_LINEAR, PKT_DATA, 5
+	},
+};
+
+static struct sk_buff *populate_skb(struct bpf_test *test, int flags)
+{
+	struct sk_buff *skb;
+	struct page *page;
+	int headlen = test->data_size;
+
+	if (flags == SKB_FRAG)
+		headlen = min(headlen, SKB_FRAG_HEADLEN);
+
+	skb = alloc_skb(headlen, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	memcpy(skb_put(skb, headlen), test->data, headlen);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb->protocol = htons(ETH_P_IP);
+
+	if (headlen < test->data_size) {
+		int fraglen = test->data_size - headlen;
+
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memcpy(page_address(page), test->data + headlen, fraglen);
+		skb_fill_page_desc(skb, 0, page, 0, fraglen);
+		skb->len += fraglen;
+		skb->data_len += fraglen;
+		skb->truesize += PAGE_SIZE;
+	}
+	return skb;
+}
+
+static struct sk_filter *prepare_filter(struct bpf_test *test)
+{
+	struct sk_filter *fp;
+	int flen = MAX_INSNS;
+
+	/*
+	 * BPF_LD|BPF_IMM encodes as zero, but every program ends with a
+	 * BPF_RET: trim the unused, zeroed tail of the array.
+	 */
+	while (flen > 1 && !test->insns[flen - 1].code)
+		flen--;
+
+	fp = kmalloc(sizeof(*fp) + flen * sizeof(struct sock_filter),
+		     GFP_KERNEL);
+	if (!fp)
+		return ERR_PTR(-ENOMEM);
+
+	memcpy(fp->insns, test->insns, flen * sizeof(struct sock_filter));
+	atomic_set(&fp->refcnt, 1);
+	fp->len = flen;
+	fp->bpf_func = __sk_run_filter;
+
+	if (sk_chk_filter(fp->insns, fp->len)) {
+		kfree(fp);
+		return ERR_PTR(-EINVAL);
+	}
+
+	bpf_jit_compile(fp);
+	return fp;
+}
+
+static void release_filter(struct sk_filter *fp)
+{
+	bpf_jit_free(fp);
+	kfree(fp);
+}
+
+static int run_one(struct bpf_test *test, struct sk_filter *fp, int flags)
+{
+	struct sk_buff *skb;
+	unsigned int interp, native;
+	int err = 0;
+
+	skb = populate_skb(test, flags);
+	if (!skb)
+		return -ENOMEM;
+
+	local_bh_disable();
+	interp = sk_run_filter(skb, fp->insns, fp->len);
+	native = SK_RUN_FILTER(fp, skb);
+	local_bh_enable();
+
+	if (interp != test->result) {
+		pr_err("test_bpf: %s (%s): interpreter returned %u, expected %u\n",
+		       test->descr, flags == SKB_FRAG ? "frag" : "linear",
+		       interp, test->result);
+		err = -EINVAL;
+	}
+	if (native != test->result) {
+		pr_err("test_bpf: %s (%s): %s returned %u, expected %u\n",
+		       test->descr, flags == SKB_FRAG ? "frag" : "linear",
+		       fp->bpf_func != __sk_run_filter ? "jit" : "bpf_func",
+		       native, test->result);
+		err = -EINVAL;
+	}
+
+	kfree_skb(skb);
+	return err;
+}
+
+static __init int test_bpf_init(void)
+{
+	int i, jited = 0, err_cnt = 0;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		struct sk_filter *fp;
+		int flags;
+
+		fp = prepare_filter(&tests[i]);
+		if (IS_ERR(fp)) {
+			pr_err("test_bpf: %s: cannot prepare filter (%ld)\n",
+			       tests[i].descr, PTR_ERR(fp));
+			err_cnt++;
+			continue;
+		}
+		if (fp->bpf_func != __sk_run_filter)
+			jited++;
+
+		for (flags = SKB_LINEAR; flags <= SKB_FRAG; flags <<= 1) {
+			if (!(tests[i].flags & flags))
+				continue;
+			if (run_one(&tests[i], fp, flags))
+				err_cnt++;
+		}
+		release_filter(fp);
+	}
+
+	if (err_cnt) {
+		pr_err("test_bpf: %d failure(s) out of %zu tests\n",
+		       err_cnt, ARRAY_SIZE(tests));
+		return -EINVAL;
+	}
+	pr_info("test_bpf: all %zu tests passed, %d of them jited\n",
+		ARRAY_SIZE(tests), jited);
+	return 0;
+}
+
+static void __exit test_bpf_exit(void)
+{
+}
+
+module_init(test_bpf_init);
+module_exit(test_bpf_exit);
+MODULE_LICENSE("GPL");
@@ -6,10 +6,19 @@
 #include <linux/module.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 
 
 static struct class *bdi_class;
 
+/*
+ * bdi_lock protects bdi_list, the registered backing devices, and the
+ * task pointers of their flusher threads.
+ */
+DEFINE_SPINLOCK(bdi_lock);
+LIST_HEAD(bdi_list);
+
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
@@ -169,6 +178,162 @@ static __init int bdi_class_init(void)
 
 postcore_initcall(bdi_class_init);
 
+int bdi_has_dirty_io(struct backing_dev_info *bdi)
+{
+	return !list_empty(&bdi->b_dirty) ||
+	       !list_empty(&bdi->b_io) ||
+	       !list_empty(&bdi->b_more_io);
+}
+
+static int bdi_start_fn(void *ptr)
+{
+	return bdi_writeback_task(ptr);
+}
+
+/*
+ * Find a registered device which has writeback to do but no flusher
+ * thread, and mark it BDI_pending.  Called with bdi_lock held.
+ */
+static struct backing_dev_info *bdi_to_fork(struct backing_dev_info *me)
+{
+	struct backing_dev_info *bdi;
+
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (bdi == me || bdi->task || !bdi_cap_writeback_dirty(bdi))
+			continue;
+		if (list_empty(&bdi->work_list) && !bdi_has_dirty_io(bdi))
+			continue;
+
+		set_bit(BDI_pending, &bdi->state);
+		return bdi;
+	}
+
+	return NULL;
+}
+
+/*
+ * The thread of the default backing device.  Flusher threads are forked
+ * from here on demand, so that devices without dirty data cost no thread.
+ * It also writes back the inodes of the default bdi itself, and the
+ * superblocks every dirty_writeback_interval, like the old kupdate timer.
+ */
+static int bdi_forker_task(void *ptr)
+{
+	struct backing_dev_info *me = ptr;
+	unsigned long last_sync = jiffies;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+	set_freezable();
+	me->last_old_flush = jiffies;
+
+	while (!kthread_should_stop()) {
+		struct backing_dev_info *bdi;
+		struct task_struct *task;
+
+		if (dirty_writeback_interval &&
+		    time_after_eq(jiffies, last_sync + dirty_writeback_interval)) {
+			last_sync = jiffies;
+			sync_supers();
+		}
+
+		wb_do_writeback(me);
+
+		spin_lock_bh(&bdi_lock);
+		bdi = bdi_to_fork(me);
+		if (!bdi) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			spin_unlock_bh(&bdi_lock);
+
+			if (list_empty(&me->work_list) && !kthread_should_stop()) {
+				if (dirty_writeback_interval)
+					schedule_timeout(dirty_writeback_interval);
+				else
+					schedule();
+			}
+			__set_current_state(TASK_RUNNING);
+			try_to_freeze();
+			continue;
+		}
+		spin_unlock_bh(&bdi_lock);
+
+		task = kthread_create(bdi_start_fn, bdi, "flush-%s",
+				      dev_name(bdi->dev));
+		if (!IS_ERR(task)) {
+			spin_lock_bh(&bdi_lock);
+			bdi->task = task;
+			spin_unlock_bh(&bdi_lock);
+			wake_up_process(task);
+		} else {
+			/*
+			 * No thread for it this time: do its writeback from
+			 * here, rather than leave the device to starve.
+			 */
+			wb_do_writeback(bdi);
+		}
+
+		clear_bit(BDI_pending, &bdi->state);
+		smp_mb__after_clear_bit();
+		wake_up_bit(&bdi->state, BDI_pending);
+	}
+
+	return 0;
+}
+
+/*
+ * Kick every flusher thread, e.g. so that a changed dirty_writeback_interval
+ * takes effect right away.
+ */
+void bdi_wakeup_flushers(void)
+{
+	struct backing_dev_info *bdi;
+
+	spin_lock_bh(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (bdi->task)
+			wake_up_process(bdi->task);
+	}
+	spin_unlock_bh(&bdi_lock);
+}
+
+static int bdi_sched_wait(void *word)
+{
+	schedule();
+	return 0;
+}
+
+/*
+ * Take @bdi off the list and stop its flusher thread, if it has one.
+ * Requests which raced with that are run from here.
+ */
+static void bdi_wb_shutdown(struct backing_dev_info *bdi)
+{
+	struct task_struct *task;
+
+	spin_lock_bh(&bdi_lock);
+	list_del(&bdi->bdi_list);
+	spin_unlock_bh(&bdi_lock);
+
+	/* From now on, bdi_start_writeback() goes to the default bdi */
+	spin_lock_bh(&bdi->wb_lock);
+	clear_bit(BDI_registered, &bdi->state);
+	spin_unlock_bh(&bdi->wb_lock);
+
+	/* The forker thread may be creating a flusher for us */
+	wait_on_bit(&bdi->state, BDI_pending, bdi_sched_wait,
+		    TASK_UNINTERRUPTIBLE);
+
+	spin_lock_bh(&bdi_lock);
+	task = bdi->task;
+	bdi->task = NULL;
+	spin_unlock_bh(&bdi_lock);
+
+	if (task)
+		kthread_stop(task);
+
+	if (!list_empty(&bdi->work_list))
+		wb_do_writeback(bdi);
+}
+
 int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 		const char *fmt, ...)
 {
@@ -187,9 +352,31 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 		goto exit;
 	}
 
+	/*
+	 * The default bdi's thread forks the flushers of all the others, so
+	 * it has to be there from the start.
+	 */
+	if (bdi == &default_backing_dev_info) {
+		struct task_struct *task;
+
+		task = kthread_run(bdi_forker_task, bdi, "bdi-%s",
+				   dev_name(dev));
+		if (IS_ERR(task)) {
+			device_unregister(dev);
+			ret = PTR_ERR(task);
+			goto exit;
+		}
+		bdi->task = task;
+	}
+
 	bdi->dev = dev;
 	bdi_debug_register(bdi, dev_name(dev));
 
+	set_bit(BDI_registered, &bdi->state);
+	spin_lock_bh(&bdi_lock);
+	list_add_tail(&bdi->bdi_list, &bdi_list);
+	spin_unlock_bh(&bdi_lock);
+
 exit:
 	return ret;
 }
@@ -204,6 +391,7 @@ EXPORT_SYMBOL(bdi_register_dev);
 void bdi_unregister(struct backing_dev_info *bdi)
 {
 	if (bdi->dev) {
+		bdi_wb_shutdown(bdi);
 		bdi_debug_unregister(bdi);
 		device_unregister(bdi->dev);
 		bdi->dev = NULL;
@@ -218,6 +406,15 @@ int bdi_init(struct backing_dev_info *bdi)
 
 	bdi->dev = NULL;
 
+	INIT_LIST_HEAD(&bdi->bdi_list);
+	bdi->task = NULL;
+	bdi->last_old_flush = jiffies;
+	INIT_LIST_HEAD(&bdi->b_dirty);
+	INIT_LIST_HEAD(&bdi->b_io);
+	INIT_LIST_HEAD(&bdi->b_more_io);
+	spin_lock_init(&bdi->wb_lock);
+	INIT_LIST_HEAD(&bdi->work_list);
+
 	bdi->min_ratio = 0;
 	bdi->max_ratio = 100;
 	bdi->max_prop_frac = PROP_FRAC_BASE;
@@ -247,6 +444,20 @@ void bdi_destroy(struct backing_dev_info *bdi)
 
 	bdi_unregister(bdi);
 
+	/*
+	 * Dirty inodes left behind are handed to the default bdi, whose
+	 * thread will write them back (or find that they have gone).
+	 */
+	if (bdi_has_dirty_io(bdi)) {
+		struct backing_dev_info *dst = &default_backing_dev_info;
+
+		spin_lock(&inode_lock);
+		list_splice_init(&bdi->b_dirty, &dst->b_more_io);
+		list_splice_init(&bdi->b_io, &dst->b_more_io);
+		list_splice_init(&bdi->b_more_io, &dst->b_more_io);
+		spin_unlock(&inode_lock);
+	}
+
 	for (i = 0; i < NR_BDI_STAT_ITEMS; i++)
 		percpu_counter_destroy(&bdi->bdi_stat[i]);
 
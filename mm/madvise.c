@@ -11,6 +11,8 @@
 #include <linux/mempolicy.h>
 #include <linux/hugetlb.h>
 #include <linux/sched.h>
+#include <linux/ksm.h>
+#include <linux/khugepaged.h>
 
 /*
  * Any behaviour which results in changes to the vma->vm_flags needs to
@@ -41,7 +43,7 @@ static long madvise_behavior(struct vm_area_struct * vma,
 	struct mm_struct * mm = vma->vm_mm;
 	int error = 0;
 	pgoff_t pgoff;
-	int new_flags = vma->vm_flags;
+	unsigned long new_flags = vma->vm_flags;
 
 	switch (behavior) {
 	case MADV_NORMAL:
@@ -59,6 +61,18 @@ static long madvise_behavior(struct vm_area_struct * vma,
 	case MADV_DOFORK:
 		new_flags &= ~VM_DONTCOPY;
 		break;
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+		error = ksm_madvise(vma, start, end, behavior, &new_flags);
+		if (error)
+			goto out;
+		break;
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
+		error = hugepage_madvise(vma, &new_flags, behavior);
+		if (error)
+			goto out;
+		break;
 	}
 
 	if (new_flags == vma->vm_flags) {
@@ -94,6 +108,13 @@ success:
 	 */
 	vma->vm_flags = new_flags;
 
+	/*
+	 * Let khugepaged know about the range now, rather than waiting for
+	 * a page fault that may not come any time soon.
+	 */
+	if (behavior == MADV_HUGEPAGE)
+		error = khugepaged_enter(vma);
+
 out:
 	if (error == -ENOMEM)
 		error = -EAGAIN;
@@ -224,6 +245,12 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 	case MADV_NORMAL:
 	case MADV_SEQUENTIAL:
 	case MADV_RANDOM:
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+#endif
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
 		error = madvise_behavior(vma, prev, start, end, behavior);
 		break;
 	case MADV_REMOVE:
@@ -269,6 +296,15 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
  *		so the kernel can free resources associated with it.
  *  MADV_REMOVE - the application wants to free up the given range of
  *		pages and associated backing store.
+ *  MADV_MERGEABLE - the application recommends that KSM try to merge
+ *		pages in this area with pages of identical content from
+ *		other such areas.
+ *  MADV_UNMERGEABLE - cancel MADV_MERGEABLE: no longer merge pages with
+ *		others, unmerging any that were merged before.
+ *  MADV_HUGEPAGE - the application wants the range to be backed by
+ *		transparent huge pages when possible.
+ *  MADV_NOHUGEPAGE - the range should never be backed by transparent
+ *		huge pages.
  *
  * return values:
  *  zero    - success
@@ -1118,6 +1118,40 @@ int mem_cgroup_newpage_charge(struct page *page,
 				MEM_CGROUP_CHARGE_TYPE_MAPPED, NULL);
 }
 
+/*
+ * A transparent huge page is charged one subpage at a time, so that the
+ * charges stay valid when it gets split into small pages later.
+ */
+int mem_cgroup_charge_huge(struct page *page, int nr,
+			   struct mm_struct *mm, gfp_t gfp_mask)
+{
+	int i, ret;
+
+	if (mem_cgroup_disabled())
+		return 0;
+	if (unlikely(!mm))
+		mm = &init_mm;
+	for (i = 0; i < nr; i++) {
+		ret = mem_cgroup_charge_common(page + i, mm, gfp_mask,
+				MEM_CGROUP_CHARGE_TYPE_MAPPED, NULL);
+		if (ret) {
+			while (--i >= 0)
+				mem_cgroup_uncharge_page(page + i);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* The head page is uncharged as usual by page_remove_rmap() */
+void mem_cgroup_uncharge_tails(struct page *page, int nr)
+{
+	int i;
+
+	for (i = 1; i < nr; i++)
+		mem_cgroup_uncharge_page(page + i);
+}
+
 int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 				gfp_t gfp_mask)
 {
@@ -46,6 +46,7 @@
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
+#include <linux/ksm.h>
 #include <linux/module.h>
 #include <linux/delayacct.h>
 #include <linux/init.h>
@@ -665,6 +666,8 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* huge pages are not shared with the child: split them */
+		split_huge_page_pmd(src_mm, src_pmd);
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -861,7 +864,17 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		if (pmd_trans_huge(*pmd)) {
+			if (next - addr != HPAGE_PMD_SIZE)
+				split_huge_page_pmd(vma->vm_mm, pmd);
+			else if (zap_huge_pmd(tlb, vma, pmd)) {
+				(*zap_work) -= HPAGE_PMD_SIZE;
+				continue;
+			}
+			/* fall through */
+		}
+		/* MADV_DONTNEED runs concurrently with page faults */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd)) {
 			(*zap_work)--;
 			continue;
 		}
@@ -1124,6 +1137,8 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 		goto no_page_table;
 
 	pmd = pmd_offset(pud, address);
+	/* callers expect small pages they can pin: see split_huge_page() */
+	split_huge_page_pmd(mm, pmd);
 	if (pmd_none(*pmd))
 		goto no_page_table;
 	if (pmd_huge(*pmd)) {
@@ -1914,7 +1929,7 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	 * Take out anonymous pages first, anonymous shared vmas are
 	 * not dirty accountable.
 	 */
-	if (PageAnon(old_page)) {
+	if (PageAnon(old_page) && !PageKsm(old_page)) {
 		if (!trylock_page(old_page)) {
 			page_cache_get(old_page);
 			pte_unmap_unlock(page_table, ptl);
@@ -2846,7 +2861,7 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 {
 	pgd_t *pgd;
 	pud_t *pud;
-	pmd_t *pmd;
+	pmd_t *pmd, orig_pmd;
 	pte_t *pte;
 
 	__set_current_state(TASK_RUNNING);
@@ -2863,9 +2878,36 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+	orig_pmd = *pmd;
+	barrier();
+	if (pmd_none(orig_pmd) && transparent_hugepage_suitable(vma)) {
+		int ret = do_huge_pmd_anonymous_page(mm, vma, address, pmd,
+						     write_access);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_trans_huge(orig_pmd)) {
+		if (unlikely(pmd_trans_splitting(orig_pmd))) {
+			wait_split_huge_page(mm, pmd);
+			return 0;
+		}
+		if (!write_access || pmd_write(orig_pmd))
+			return 0;	/* spurious, the pmd is fine */
+		split_huge_page_pmd(mm, pmd);
+	}
+
+	/*
+	 * Not pte_alloc_map(): a huge pmd may materialize from under us
+	 * (or be zapped again) while we look, and pte_offset_map() must
+	 * only ever be run on a pmd that points to a pte table.  Just let
+	 * the fault be retried in that case.
+	 */
+	if (unlikely(pmd_none(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	orig_pmd = *pmd;
+	barrier();
+	if (unlikely(pmd_none(orig_pmd) || pmd_trans_huge(orig_pmd)))
+		return 0;
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, write_access);
 }
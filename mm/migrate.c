@@ -100,7 +100,7 @@ static void remove_migration_pte(struct vm_area_struct *vma,
                 return;
 
 	pmd = pmd_offset(pud, addr);
-	if (!pmd_present(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		return;
 
 	ptep = pte_offset_map(pmd, addr);
@@ -616,6 +616,10 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 		lock_page(page);
 	}
 
+	/* only small pages are migrated, retry once the split is done */
+	if (PageTransHuge(page) && split_huge_page(page))
+		goto unlock;
+
 	/* charge against new page */
 	charge = mem_cgroup_prepare_migration(page, &mem);
 	if (charge == -ENOMEM) {
@@ -95,7 +95,13 @@ static long do_mincore(unsigned long addr, unsigned char *vec, unsigned long pag
 	if (pud_none_or_clear_bad(pud))
 		goto none_mapped;
 	pmd = pmd_offset(pud, addr);
-	if (pmd_none_or_clear_bad(pmd))
+	if (pmd_trans_huge(*pmd)) {
+		/* anonymous, and all of it is there */
+		for (i = 0; i < nr; i++)
+			vec[i] = 1;
+		return nr;
+	}
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 		goto none_mapped;
 
 	ptep = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
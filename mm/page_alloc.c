@@ -46,6 +46,7 @@
 #include <linux/page-isolation.h>
 #include <linux/page_cgroup.h>
 #include <linux/debugobjects.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -549,6 +550,9 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	int i;
 	int bad = 0;
 
+	/* transparent huge pages are anonymous, like order 0 ones */
+	if (PageAnon(page))
+		page->mapping = NULL;
 	for (i = 0 ; i < (1 << order) ; ++i)
 		bad += free_pages_check(page + i);
 	if (bad)
@@ -1057,6 +1061,51 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+/*
+ * Similar to split_page except the page is already free. As this is only
+ * being used for migration, the migratetype of the block also changes.
+ * As this is called with interrupts disabled, the caller is responsible
+ * for calling arch_alloc_page() and kernel_map_page() after interrupts
+ * are enabled.
+ *
+ * Note: this is probably too low level an operation for use in drivers.
+ * Please consult with lkml before using this in your driver.
+ */
+int split_free_page(struct page *page)
+{
+	unsigned int order;
+	unsigned long watermark;
+	struct zone *zone;
+
+	BUG_ON(!PageBuddy(page));
+
+	zone = page_zone(page);
+	order = page_order(page);
+
+	/* Obey watermarks as if the page was being allocated */
+	watermark = zone->pages_low + (1 << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return 0;
+
+	/* Remove page from free list */
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order(page);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+
+	/* Split into individual pages */
+	set_page_refcounted(page);
+	split_page(page, order);
+
+	if (order >= pageblock_order - 1) {
+		struct page *endpage = page + (1 << order) - 1;
+		for (; page < endpage; page += pageblock_nr_pages)
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+	}
+
+	return 1 << order;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1460,6 +1509,65 @@ try_next_zone:
 	return page;
 }
 
+#ifdef CONFIG_COMPACTION
+/* Try memory compaction for high-order allocations before reclaim */
+static struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags)
+{
+	struct zone *preferred_zone;
+	struct page *page;
+	unsigned long compact_result;
+
+	if (!order)
+		return NULL;
+
+	first_zones_zonelist(zonelist, high_zoneidx, nodemask,
+			     &preferred_zone);
+	if (!preferred_zone || compaction_deferred(preferred_zone))
+		return NULL;
+
+	current->flags |= PF_MEMALLOC;
+	compact_result = try_to_compact_pages(zonelist, order, gfp_mask,
+					      nodemask);
+	current->flags &= ~PF_MEMALLOC;
+	if (compact_result == COMPACT_SKIPPED)
+		return NULL;
+
+	/* Page migration frees to the PCP lists but we want merging */
+	drain_local_pages(NULL);
+
+	page = get_page_from_freelist(gfp_mask, nodemask, order, zonelist,
+				      high_zoneidx, alloc_flags);
+	if (page) {
+		compaction_reset_defer(preferred_zone);
+		count_vm_event(COMPACTSUCCESS);
+		return page;
+	}
+
+	/*
+	 * It's bad if compaction run occurs and fails.  The most likely
+	 * reason is that pages exist, but not enough to satisfy
+	 * watermarks: back off from compacting this zone for a while.
+	 */
+	count_vm_event(COMPACTFAIL);
+	defer_compaction(preferred_zone);
+
+	cond_resched();
+
+	return NULL;
+}
+#else
+static inline struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags)
+{
+	return NULL;
+}
+#endif /* CONFIG_COMPACTION */
+
 /*
  * This is the 'heart' of the zoned buddy allocator.
  */
@@ -1571,6 +1679,17 @@ nofail_alloc:
 
 	cond_resched();
 
+	/*
+	 * High-order allocations first try to compact memory: moving
+	 * pages around is far cheaper than reclaiming (and later
+	 * refaulting) enough of them to free a contiguous block.
+	 */
+	page = __alloc_pages_direct_compact(gfp_mask, order, zonelist,
+					    high_zoneidx, nodemask,
+					    alloc_flags);
+	if (page)
+		goto got_pg;
+
 	/* We now go into synchronous reclaim */
 	cpuset_memory_pressure_bump();
 	/*
@@ -191,7 +191,7 @@ void __init anon_vma_init(void)
  * Getting a lock on a stable anon_vma from a page off the LRU is
  * tricky: page_lock_anon_vma rely on RCU to guard against the races.
  */
-static struct anon_vma *page_lock_anon_vma(struct page *page)
+struct anon_vma *page_lock_anon_vma(struct page *page)
 {
 	struct anon_vma *anon_vma;
 	unsigned long anon_mapping;
@@ -211,7 +211,7 @@ out:
 	return NULL;
 }
 
-static void page_unlock_anon_vma(struct anon_vma *anon_vma)
+void page_unlock_anon_vma(struct anon_vma *anon_vma)
 {
 	spin_unlock(&anon_vma->lock);
 	rcu_read_unlock();
@@ -222,8 +222,7 @@ static void page_unlock_anon_vma(struct anon_vma *anon_vma)
  * Returns virtual address or -EFAULT if page's index/offset is not
  * within the range mapped the @vma.
  */
-static inline unsigned long
-vma_address(struct page *page, struct vm_area_struct *vma)
+unsigned long vma_address(struct page *page, struct vm_area_struct *vma)
 {
 	pgoff_t pgoff = page->index << (PAGE_CACHE_SHIFT - PAGE_SHIFT);
 	unsigned long address;
@@ -284,6 +283,9 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
+	/* huge pmds are handled by page_check_address_pmd() */
+	if (pmd_trans_huge(*pmd))
+		return NULL;
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
@@ -345,6 +347,21 @@ static int page_referenced_one(struct page *page,
 	if (address == -EFAULT)
 		goto out;
 
+	if (unlikely(PageTransHuge(page))) {
+		pmd_t *pmd;
+
+		/* mlock splits huge pages, so no VM_LOCKED check here */
+		spin_lock(&mm->page_table_lock);
+		pmd = page_check_address_pmd(page, mm, address);
+		if (pmd) {
+			if (pmdp_clear_flush_young(vma, address, pmd))
+				referenced++;
+			(*mapcount)--;
+		}
+		spin_unlock(&mm->page_table_lock);
+		goto out;
+	}
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -606,7 +623,12 @@ static void __page_set_anon_rmap(struct page *page,
 	 * nr_mapped state can be updated without turning off
 	 * interrupts because it is not modified via interrupt.
 	 */
-	__inc_zone_page_state(page, NR_ANON_PAGES);
+	if (PageTransHuge(page)) {
+		__mod_zone_page_state(page_zone(page), NR_ANON_PAGES,
+				      HPAGE_PMD_NR);
+		__inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	} else
+		__inc_zone_page_state(page, NR_ANON_PAGES);
 }
 
 /**
@@ -736,8 +758,15 @@ void page_remove_rmap(struct page *page)
 		}
 		if (PageAnon(page))
 			mem_cgroup_uncharge_page(page);
-		__dec_zone_page_state(page,
-			PageAnon(page) ? NR_ANON_PAGES : NR_FILE_MAPPED);
+		if (PageAnon(page) && PageTransHuge(page)) {
+			mem_cgroup_uncharge_tails(page, HPAGE_PMD_NR);
+			__mod_zone_page_state(page_zone(page), NR_ANON_PAGES,
+					      -HPAGE_PMD_NR);
+			__dec_zone_page_state(page,
+					      NR_ANON_TRANSPARENT_HUGEPAGES);
+		} else
+			__dec_zone_page_state(page,
+				PageAnon(page) ? NR_ANON_PAGES : NR_FILE_MAPPED);
 		/*
 		 * It would be tidy to reset the PageAnon mapping here,
 		 * but that might overwrite a racing page_add_anon_rmap
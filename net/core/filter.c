@@ -88,8 +88,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -347,6 +346,19 @@ load_b:
 }
 EXPORT_SYMBOL(sk_run_filter);
 
+/**
+ *	__sk_run_filter - interpret an attached filter
+ *	@skb: buffer to run the filter on
+ *	@fp: filter to apply
+ *
+ * Default &sk_filter.bpf_func, used when no native image was built.
+ */
+unsigned int __sk_run_filter(struct sk_buff *skb, const struct sk_filter *fp)
+{
+	return sk_run_filter(skb, (struct sock_filter *)fp->insns, fp->len);
+}
+EXPORT_SYMBOL(__sk_run_filter);
+
 /**
  *	sk_chk_filter - verify socket filter code
  *	@filter: filter to verify
@@ -507,6 +519,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = __sk_run_filter;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -514,6 +527,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
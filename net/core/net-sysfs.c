@@ -17,6 +17,8 @@
 #include <linux/rtnetlink.h>
 #include <linux/wireless.h>
 #include <net/iw_handler.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 
 #include "net-sysfs.h"
 
@@ -245,6 +247,194 @@ static ssize_t show_ifalias(struct device *dev,
 	return ret;
 }
 
+#ifdef CONFIG_RPS
+static ssize_t show_rps_cpus(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *map;
+	cpumask_var_t mask;
+	size_t len;
+	int i;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+	cpumask_clear(mask);
+
+	rcu_read_lock();
+	map = rcu_dereference(net->rps_map);
+	if (map)
+		for (i = 0; i < map->len; i++)
+			cpumask_set_cpu(map->cpus[i], mask);
+	rcu_read_unlock();
+
+	len = cpumask_scnprintf(buf, PAGE_SIZE - 1, mask);
+	buf[len++] = '\n';
+
+	free_cpumask_var(mask);
+	return len;
+}
+
+static void rps_map_release(struct rcu_head *rcu)
+{
+	struct rps_map *map = container_of(rcu, struct rps_map, rcu);
+
+	kfree(map);
+}
+
+/* use same locking and permission rules as SIF* ioctl's */
+static ssize_t store_rps_cpus(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t len)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *old_map, *map;
+	cpumask_var_t mask;
+	int err, cpu, i;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	err = bitmap_parse(buf, len, cpumask_bits(mask), nr_cpumask_bits);
+	if (err) {
+		free_cpumask_var(mask);
+		return err;
+	}
+
+	map = kzalloc(max_t(unsigned,
+	    RPS_MAP_SIZE(cpumask_weight(mask)), L1_CACHE_BYTES),
+	    GFP_KERNEL);
+	if (!map) {
+		free_cpumask_var(mask);
+		return -ENOMEM;
+	}
+
+	i = 0;
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		map->cpus[i++] = cpu;
+
+	if (i)
+		map->len = i;
+	else {
+		kfree(map);
+		map = NULL;
+	}
+	free_cpumask_var(mask);
+
+	if (!rtnl_trylock()) {
+		kfree(map);
+		return -ERESTARTSYS;
+	}
+
+	if (!dev_isalive(net)) {
+		rtnl_unlock();
+		kfree(map);
+		return -EINVAL;
+	}
+
+	old_map = net->rps_map;
+	rcu_assign_pointer(net->rps_map, map);
+	rtnl_unlock();
+
+	if (old_map)
+		call_rcu(&old_map->rcu, rps_map_release);
+
+	return len;
+}
+
+static ssize_t show_rps_flow_cnt(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_dev_flow_table *flow_table;
+	unsigned int val = 0;
+
+	rcu_read_lock();
+	flow_table = rcu_dereference(net->rps_flow_table);
+	if (flow_table)
+		val = flow_table->mask + 1;
+	rcu_read_unlock();
+
+	return sprintf(buf, "%u\n", val);
+}
+
+static void rps_dev_flow_table_release_work(struct work_struct *work)
+{
+	struct rps_dev_flow_table *table = container_of(work,
+	    struct rps_dev_flow_table, free_work);
+
+	vfree(table);
+}
+
+static void rps_dev_flow_table_release(struct rcu_head *rcu)
+{
+	struct rps_dev_flow_table *table = container_of(rcu,
+	    struct rps_dev_flow_table, rcu);
+
+	/* vfree() may not be called from softirq context */
+	INIT_WORK(&table->free_work, rps_dev_flow_table_release_work);
+	schedule_work(&table->free_work);
+}
+
+/* use same locking and permission rules as SIF* ioctl's */
+static ssize_t store_rps_flow_cnt(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t len)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_dev_flow_table *table, *old_table;
+	unsigned long count;
+	char *endp;
+	int i;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	count = simple_strtoul(buf, &endp, 0);
+	if (endp == buf)
+		return -EINVAL;
+
+	if (count) {
+		if (count > 1<<30) {
+			/* Enforce a limit to prevent overflow */
+			return -EINVAL;
+		}
+		count = roundup_pow_of_two(count);
+		table = vmalloc(RPS_DEV_FLOW_TABLE_SIZE(count));
+		if (!table)
+			return -ENOMEM;
+
+		table->mask = count - 1;
+		for (i = 0; i < count; i++)
+			table->flows[i].cpu = RPS_NO_CPU;
+	} else
+		table = NULL;
+
+	if (!rtnl_trylock()) {
+		vfree(table);
+		return -ERESTARTSYS;
+	}
+
+	if (!dev_isalive(net)) {
+		rtnl_unlock();
+		vfree(table);
+		return -EINVAL;
+	}
+
+	old_table = net->rps_flow_table;
+	rcu_assign_pointer(net->rps_flow_table, table);
+	rtnl_unlock();
+
+	if (old_table)
+		call_rcu(&old_table->rcu, rps_dev_flow_table_release);
+
+	return len;
+}
+#endif /* CONFIG_RPS */
+
 static struct device_attribute net_class_attributes[] = {
 	__ATTR(addr_len, S_IRUGO, show_addr_len, NULL),
 	__ATTR(dev_id, S_IRUGO, show_dev_id, NULL),
@@ -263,6 +453,11 @@ static struct device_attribute net_class_attributes[] = {
 	__ATTR(flags, S_IRUGO | S_IWUSR, show_flags, store_flags),
 	__ATTR(tx_queue_len, S_IRUGO | S_IWUSR, show_tx_queue_len,
 	       store_tx_queue_len),
+#ifdef CONFIG_RPS
+	__ATTR(rps_cpus, S_IRUGO | S_IWUSR, show_rps_cpus, store_rps_cpus),
+	__ATTR(rps_flow_cnt, S_IRUGO | S_IWUSR, show_rps_flow_cnt,
+	       store_rps_flow_cnt),
+#endif
 	{}
 };
 
@@ -421,6 +616,411 @@ static struct attribute_group wireless_group = {
 };
 #endif
 
+/*
+ * netdev_queue sysfs structures and functions.
+ */
+struct netdev_queue_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct netdev_queue *queue,
+	    struct netdev_queue_attribute *attr, char *buf);
+	ssize_t (*store)(struct netdev_queue *queue,
+	    struct netdev_queue_attribute *attr, const char *buf, size_t len);
+};
+#define to_netdev_queue_attr(_attr) container_of(_attr,		\
+    struct netdev_queue_attribute, attr)
+
+#define to_netdev_queue(obj) container_of(obj, struct netdev_queue, kobj)
+
+static ssize_t netdev_queue_attr_show(struct kobject *kobj,
+				      struct attribute *attr, char *buf)
+{
+	struct netdev_queue_attribute *attribute = to_netdev_queue_attr(attr);
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	if (!attribute->show)
+		return -EIO;
+
+	return attribute->show(queue, attribute, buf);
+}
+
+static ssize_t netdev_queue_attr_store(struct kobject *kobj,
+				       struct attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct netdev_queue_attribute *attribute = to_netdev_queue_attr(attr);
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	if (!attribute->store)
+		return -EIO;
+
+	return attribute->store(queue, attribute, buf, count);
+}
+
+static struct sysfs_ops netdev_queue_sysfs_ops = {
+	.show = netdev_queue_attr_show,
+	.store = netdev_queue_attr_store,
+};
+
+static inline unsigned int get_netdev_queue_index(struct netdev_queue *queue)
+{
+	return queue - queue->dev->_tx;
+}
+
+#ifdef CONFIG_XPS
+static ssize_t show_xps_map(struct netdev_queue *queue,
+			    struct netdev_queue_attribute *attribute, char *buf)
+{
+	struct net_device *dev = queue->dev;
+	struct xps_dev_maps *dev_maps;
+	unsigned int index = get_netdev_queue_index(queue);
+	cpumask_var_t mask;
+	size_t len;
+	int i, cpu;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+	cpumask_clear(mask);
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(dev->xps_maps);
+	if (dev_maps) {
+		for_each_possible_cpu(cpu) {
+			struct xps_map *map = dev_maps->cpu_map[cpu];
+
+			if (!map)
+				continue;
+			for (i = 0; i < map->len; i++)
+				if (map->queues[i] == index) {
+					cpumask_set_cpu(cpu, mask);
+					break;
+				}
+		}
+	}
+	rcu_read_unlock();
+
+	len = cpumask_scnprintf(buf, PAGE_SIZE - 1, mask);
+	buf[len++] = '\n';
+
+	free_cpumask_var(mask);
+	return len;
+}
+
+static void xps_dev_maps_release(struct rcu_head *rcu)
+{
+	struct xps_dev_maps *dev_maps =
+	    container_of(rcu, struct xps_dev_maps, rcu);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(dev_maps->cpu_map[cpu]);
+	kfree(dev_maps);
+}
+
+/*
+ * Build a new set of per CPU maps from the current ones, with this
+ * queue present exactly in the maps of the CPUs in @mask.
+ */
+static struct xps_dev_maps *xps_build_maps(struct xps_dev_maps *dev_maps,
+					   unsigned int index,
+					   const struct cpumask *mask)
+{
+	struct xps_dev_maps *new_dev_maps;
+	int cpu, i, nonempty = 0;
+
+	new_dev_maps = kzalloc(XPS_DEV_MAPS_SIZE, GFP_KERNEL);
+	if (!new_dev_maps)
+		return ERR_PTR(-ENOMEM);
+
+	for_each_possible_cpu(cpu) {
+		struct xps_map *map = dev_maps ? dev_maps->cpu_map[cpu] : NULL;
+		struct xps_map *new_map;
+		unsigned int len = map ? map->len : 0;
+		int add = cpumask_test_cpu(cpu, mask);
+
+		if (!len && !add)
+			continue;
+
+		new_map = kzalloc(XPS_MAP_SIZE(len + 1), GFP_KERNEL);
+		if (!new_map) {
+			xps_dev_maps_release(&new_dev_maps->rcu);
+			return ERR_PTR(-ENOMEM);
+		}
+
+		for (i = 0; i < len; i++)
+			if (map->queues[i] != index)
+				new_map->queues[new_map->len++] =
+				    map->queues[i];
+		if (add)
+			new_map->queues[new_map->len++] = index;
+
+		if (!new_map->len) {
+			kfree(new_map);
+			continue;
+		}
+		new_dev_maps->cpu_map[cpu] = new_map;
+		nonempty = 1;
+	}
+
+	if (!nonempty) {
+		kfree(new_dev_maps);
+		new_dev_maps = NULL;
+	}
+
+	return new_dev_maps;
+}
+
+/* use same locking and permission rules as SIF* ioctl's */
+static ssize_t store_xps_map(struct netdev_queue *queue,
+			     struct netdev_queue_attribute *attribute,
+			     const char *buf, size_t len)
+{
+	struct net_device *dev = queue->dev;
+	struct xps_dev_maps *dev_maps, *new_dev_maps;
+	unsigned int index = get_netdev_queue_index(queue);
+	cpumask_var_t mask;
+	int err;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	err = bitmap_parse(buf, len, cpumask_bits(mask), nr_cpumask_bits);
+	if (err) {
+		free_cpumask_var(mask);
+		return err;
+	}
+
+	if (!rtnl_trylock()) {
+		free_cpumask_var(mask);
+		return -ERESTARTSYS;
+	}
+
+	if (!dev_isalive(dev)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	dev_maps = dev->xps_maps;
+	new_dev_maps = xps_build_maps(dev_maps, index, mask);
+	if (IS_ERR(new_dev_maps)) {
+		err = PTR_ERR(new_dev_maps);
+		goto out;
+	}
+
+	rcu_assign_pointer(dev->xps_maps, new_dev_maps);
+	if (dev_maps)
+		call_rcu(&dev_maps->rcu, xps_dev_maps_release);
+	err = len;
+out:
+	rtnl_unlock();
+	free_cpumask_var(mask);
+	return err;
+}
+
+static struct netdev_queue_attribute xps_cpus_attribute =
+    __ATTR(xps_cpus, S_IRUGO | S_IWUSR, show_xps_map, store_xps_map);
+#endif /* CONFIG_XPS */
+
+#ifdef CONFIG_BQL
+/*
+ * Byte queue limits sysfs structures and functions.
+ */
+static ssize_t bql_show(char *buf, unsigned int value)
+{
+	return sprintf(buf, "%u\n", value);
+}
+
+static ssize_t bql_set(const char *buf, const size_t count,
+		       unsigned int *pvalue)
+{
+	unsigned long value;
+	char *endp;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!strncmp(buf, "max", 3))
+		value = DQL_MAX_LIMIT;
+	else {
+		value = simple_strtoul(buf, &endp, 0);
+		if (endp == buf || value > DQL_MAX_LIMIT)
+			return -EINVAL;
+	}
+
+	*pvalue = value;
+
+	return count;
+}
+
+static ssize_t bql_show_hold_time(struct netdev_queue *queue,
+				  struct netdev_queue_attribute *attr,
+				  char *buf)
+{
+	struct dql *dql = &queue->dql;
+
+	return sprintf(buf, "%u\n", jiffies_to_msecs(dql->slack_hold_time));
+}
+
+static ssize_t bql_set_hold_time(struct netdev_queue *queue,
+				 struct netdev_queue_attribute *attribute,
+				 const char *buf, size_t len)
+{
+	struct dql *dql = &queue->dql;
+	unsigned long value;
+	char *endp;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	value = simple_strtoul(buf, &endp, 0);
+	if (endp == buf)
+		return -EINVAL;
+
+	dql->slack_hold_time = msecs_to_jiffies(value);
+
+	return len;
+}
+
+static struct netdev_queue_attribute bql_hold_time_attribute =
+	__ATTR(hold_time, S_IRUGO | S_IWUSR, bql_show_hold_time,
+	    bql_set_hold_time);
+
+static ssize_t bql_show_inflight(struct netdev_queue *queue,
+				 struct netdev_queue_attribute *attr,
+				 char *buf)
+{
+	struct dql *dql = &queue->dql;
+
+	return sprintf(buf, "%u\n", dql->num_queued - dql->num_completed);
+}
+
+static struct netdev_queue_attribute bql_inflight_attribute =
+	__ATTR(inflight, S_IRUGO, bql_show_inflight, NULL);
+
+#define BQL_ATTR(NAME, FIELD)						\
+static ssize_t bql_show_ ## NAME(struct netdev_queue *queue,		\
+				 struct netdev_queue_attribute *attr,	\
+				 char *buf)				\
+{									\
+	return bql_show(buf, queue->dql.FIELD);				\
+}									\
+									\
+static ssize_t bql_set_ ## NAME(struct netdev_queue *queue,		\
+				struct netdev_queue_attribute *attr,	\
+				const char *buf, size_t len)		\
+{									\
+	return bql_set(buf, len, &queue->dql.FIELD);			\
+}									\
+									\
+static struct netdev_queue_attribute bql_ ## NAME ## _attribute =	\
+	__ATTR(NAME, S_IRUGO | S_IWUSR, bql_show_ ## NAME,		\
+	    bql_set_ ## NAME);
+
+BQL_ATTR(limit, limit)
+BQL_ATTR(limit_max, max_limit)
+BQL_ATTR(limit_min, min_limit)
+
+static struct attribute *dql_attrs[] = {
+	&bql_limit_attribute.attr,
+	&bql_limit_max_attribute.attr,
+	&bql_limit_min_attribute.attr,
+	&bql_hold_time_attribute.attr,
+	&bql_inflight_attribute.attr,
+	NULL
+};
+
+static struct attribute_group dql_group = {
+	.name  = "byte_queue_limits",
+	.attrs  = dql_attrs,
+};
+#endif /* CONFIG_BQL */
+
+static struct attribute *netdev_queue_default_attrs[] = {
+#ifdef CONFIG_XPS
+	&xps_cpus_attribute.attr,
+#endif
+	NULL
+};
+
+static void netdev_queue_release(struct kobject *kobj)
+{
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	dev_put(queue->dev);
+}
+
+static struct kobj_type netdev_queue_ktype = {
+	.sysfs_ops = &netdev_queue_sysfs_ops,
+	.release = netdev_queue_release,
+	.default_attrs = netdev_queue_default_attrs,
+};
+
+static int netdev_queue_add_kobject(struct net_device *net, int index)
+{
+	struct netdev_queue *queue = net->_tx + index;
+	struct kobject *kobj = &queue->kobj;
+	int error;
+
+	/* Dropped by netdev_queue_release, also on the error paths */
+	dev_hold(queue->dev);
+
+	kobj->kset = net->queues_kset;
+	error = kobject_init_and_add(kobj, &netdev_queue_ktype, NULL,
+	    "tx-%u", index);
+	if (error) {
+		kobject_put(kobj);
+		return error;
+	}
+
+#ifdef CONFIG_BQL
+	error = sysfs_create_group(kobj, &dql_group);
+	if (error) {
+		kobject_put(kobj);
+		return error;
+	}
+#endif
+
+	kobject_uevent(kobj, KOBJ_ADD);
+
+	return 0;
+}
+
+static void remove_queue_kobjects(struct net_device *net, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+#ifdef CONFIG_BQL
+		sysfs_remove_group(&net->_tx[i].kobj, &dql_group);
+#endif
+		kobject_put(&net->_tx[i].kobj);
+	}
+	kset_unregister(net->queues_kset);
+	net->queues_kset = NULL;
+}
+
+static int register_queue_kobjects(struct net_device *net)
+{
+	int error, i;
+
+	net->queues_kset = kset_create_and_add("queues",
+	    NULL, &net->dev.kobj);
+	if (!net->queues_kset)
+		return -ENOMEM;
+
+	for (i = 0; i < net->num_tx_queues; i++) {
+		error = netdev_queue_add_kobject(net, i);
+		if (error) {
+			remove_queue_kobjects(net, i);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
 #endif /* CONFIG_SYSFS */
 
 #ifdef CONFIG_HOTPLUG
@@ -484,6 +1084,11 @@ void netdev_unregister_kobject(struct net_device * net)
 	if (dev_net(net) != &init_net)
 		return;
 
+#ifdef CONFIG_SYSFS
+	if (net->queues_kset)
+		remove_queue_kobjects(net, net->num_tx_queues);
+#endif
+
 	device_del(dev);
 }
 
@@ -492,6 +1097,7 @@ int netdev_register_kobject(struct net_device *net)
 {
 	struct device *dev = &(net->dev);
 	struct attribute_group **groups = net->sysfs_groups;
+	int error;
 
 	dev->class = &net_class;
 	dev->platform_data = net;
@@ -512,7 +1118,19 @@ int netdev_register_kobject(struct net_device *net)
 	if (dev_net(net) != &init_net)
 		return 0;
 
-	return device_add(dev);
+	error = device_add(dev);
+	if (error)
+		return error;
+
+#ifdef CONFIG_SYSFS
+	error = register_queue_kobjects(net);
+	if (error) {
+		device_del(dev);
+		return error;
+	}
+#endif
+
+	return 0;
 }
 
 int netdev_class_create_file(struct class_attribute *class_attr)
@@ -144,6 +144,7 @@ void free_fib_info(struct fib_info *fi)
 		printk(KERN_WARNING "Freeing alive fib_info %p\n", fi);
 		return;
 	}
+	rt_cache_release(fi);
 	change_nexthops(fi) {
 		if (nh->nh_dev)
 			dev_put(nh->nh_dev);
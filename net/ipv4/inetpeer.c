@@ -65,6 +65,7 @@
  *		dtime: unused node list lock
  *		v4daddr: unchangeable
  *		ip_id_count: idlock
+ *		tcp_fastopen_cookie{,_len}: tcp_fastopen_lock (tcp_fastopen.c)
  */
 
 /* Exported for inet_getid inline function.  */
@@ -392,6 +393,7 @@ struct inet_peer *inet_getpeer(__be32 daddr, int create)
 	atomic_set(&n->rid, 0);
 	n->ip_id_count = secure_ip_id(daddr);
 	n->tcp_ts_stamp = 0;
+	n->tcp_fastopen_cookie_len = 0;
 
 	write_lock_bh(&peer_pool_lock);
 	/* Check if an entry has suddenly appeared. */
@@ -115,6 +115,12 @@
 
 #define RT_GC_TIMEOUT (300*HZ)
 
+/*
+ * gc_interval sets how often displaced routes nobody holds any more are
+ * reaped (see rt_uncached_reap()).  max_size, the other gc_* knobs and
+ * secret_interval have no effect any more, they are only kept so that
+ * existing sysctl settings still apply.
+ */
 static int ip_rt_max_size;
 static int ip_rt_gc_timeout __read_mostly	= RT_GC_TIMEOUT;
 static int ip_rt_gc_interval __read_mostly	= 60 * HZ;
@@ -129,10 +135,6 @@ static int ip_rt_mtu_expires __read_mostly	= 10 * 60 * HZ;
 static int ip_rt_min_pmtu __read_mostly		= 512 + 20 + 20;
 static int ip_rt_min_advmss __read_mostly	= 256;
 static int ip_rt_secret_interval __read_mostly	= 10 * 60 * HZ;
-static int rt_chain_length_max __read_mostly	= 20;
-
-static void rt_worker_func(struct work_struct *work);
-static DECLARE_DELAYED_WORK(expires_work, rt_worker_func);
 
 /*
  *	Interface to generic destination cache.
@@ -145,14 +147,11 @@ static void		 ipv4_dst_ifdown(struct dst_entry *dst,
 static struct dst_entry *ipv4_negative_advice(struct dst_entry *dst);
 static void		 ipv4_link_failure(struct sk_buff *skb);
 static void		 ip_rt_update_pmtu(struct dst_entry *dst, u32 mtu);
-static int rt_garbage_collect(struct dst_ops *ops);
-static void rt_emergency_hash_rebuild(struct net *net);
 
 
 static struct dst_ops ipv4_dst_ops = {
 	.family =		AF_INET,
 	.protocol =		__constant_htons(ETH_P_IP),
-	.gc =			rt_garbage_collect,
 	.check =		ipv4_dst_check,
 	.destroy =		ipv4_dst_destroy,
 	.ifdown =		ipv4_dst_ifdown,
@@ -187,184 +186,66 @@ const __u8 ip_tos2prio[16] = {
 
 /*
  * Route cache.
- */
-
-/* The locking scheme is rather straight forward:
  *
- * 1) Read-Copy Update protects the buckets of the central route hash.
- * 2) Only writers remove entries, and they hold the lock
- *    as they look at rtable reference counts.
- * 3) Only readers acquire references to rtable entries,
- *    they do so with atomic increments and with the
- *    lock held.
- */
-
-struct rt_hash_bucket {
-	struct rtable	*chain;
-};
-
-#if defined(CONFIG_SMP) || defined(CONFIG_DEBUG_SPINLOCK) || \
-	defined(CONFIG_PROVE_LOCKING)
-/*
- * Instead of using one spinlock for each rt_hash_bucket, we use a table of spinlocks
- * The size of this table is a power of two and depends on the number of CPUS.
- * (on lockdep we have a quite big spinlock_t, so keep the size down there)
+ * There is no global cache of flows: every lookup goes to the FIB, and the
+ * route built from the result is kept in a small table hanging off the
+ * fib_info it came from.  Input routes share one table per fib_info,
+ * output routes get a row of slots per cpu.  A colliding route replaces
+ * a previous one, so the memory the slots use is bounded by the number
+ * of nexthops rather than by the number of flows.
+ *
+ * Slots are read under rcu_read_lock_bh() by someone holding a reference
+ * on the fib_info (fib_lookup() takes one) and updated with xchg().  A
+ * slot does not own a reference on its route.  Input slots are grouped in
+ * small buckets and a miss replaces the least recently used entry of its
+ * bucket; the displaced input route is released with rt_free(), only
+ * in-flight skbs can still be using it.
+ *
+ * An output route displaced by a colliding flow is different: sockets
+ * keep it in their dst cache, and killing it would make each of them
+ * route again on its next packet and evict someone else in turn.  So it
+ * is moved to the per cpu uncached list instead, where it stays valid
+ * until its last user lets go or the cache is flushed.  Those lists are
+ * the only thing left to garbage collect, every ip_rt_gc_interval.  An
+ * exception learnt later does not reach them: a socket holding such a
+ * route updates it itself when the ICMP concerns it (ip_rt_update_pmtu()).
  */
-#ifdef CONFIG_LOCKDEP
-# define RT_HASH_LOCK_SZ	256
-#else
-# if NR_CPUS >= 32
-#  define RT_HASH_LOCK_SZ	4096
-# elif NR_CPUS >= 16
-#  define RT_HASH_LOCK_SZ	2048
-# elif NR_CPUS >= 8
-#  define RT_HASH_LOCK_SZ	1024
-# elif NR_CPUS >= 4
-#  define RT_HASH_LOCK_SZ	512
-# else
-#  define RT_HASH_LOCK_SZ	256
-# endif
-#endif
-
-static spinlock_t	*rt_hash_locks;
-# define rt_hash_lock_addr(slot) &rt_hash_locks[(slot) & (RT_HASH_LOCK_SZ - 1)]
 
-static __init void rt_hash_lock_init(void)
-{
-	int i;
+#define RT_INPUT_BUCKETS	256
+#define RT_INPUT_WAYS		4
+#define RT_OUTPUT_SLOTS		16
 
-	rt_hash_locks = kmalloc(sizeof(spinlock_t) * RT_HASH_LOCK_SZ,
-			GFP_KERNEL);
-	if (!rt_hash_locks)
-		panic("IP: failed to allocate rt_hash_locks\n");
-
-	for (i = 0; i < RT_HASH_LOCK_SZ; i++)
-		spin_lock_init(&rt_hash_locks[i]);
-}
-#else
-# define rt_hash_lock_addr(slot) NULL
-
-static inline void rt_hash_lock_init(void)
-{
-}
-#endif
-
-static struct rt_hash_bucket 	*rt_hash_table __read_mostly;
-static unsigned			rt_hash_mask __read_mostly;
-static unsigned int		rt_hash_log  __read_mostly;
+static u32 rt_cache_rnd __read_mostly;
 
 static DEFINE_PER_CPU(struct rt_cache_stat, rt_cache_stat);
 #define RT_CACHE_STAT_INC(field) \
 	(__raw_get_cpu_var(rt_cache_stat).field++)
 
-static inline unsigned int rt_hash(__be32 daddr, __be32 saddr, int idx,
-		int genid)
-{
-	return jhash_3words((__force u32)(__be32)(daddr),
-			    (__force u32)(__be32)(saddr),
-			    idx, genid)
-		& rt_hash_mask;
-}
-
 static inline int rt_genid(struct net *net)
 {
 	return atomic_read(&net->ipv4.rt_genid);
 }
 
 #ifdef CONFIG_PROC_FS
-struct rt_cache_iter_state {
-	struct seq_net_private p;
-	int bucket;
-	int genid;
-};
-
-static struct rtable *rt_cache_get_first(struct seq_file *seq)
-{
-	struct rt_cache_iter_state *st = seq->private;
-	struct rtable *r = NULL;
-
-	for (st->bucket = rt_hash_mask; st->bucket >= 0; --st->bucket) {
-		if (!rt_hash_table[st->bucket].chain)
-			continue;
-		rcu_read_lock_bh();
-		r = rcu_dereference(rt_hash_table[st->bucket].chain);
-		while (r) {
-			if (dev_net(r->u.dst.dev) == seq_file_net(seq) &&
-			    r->rt_genid == st->genid)
-				return r;
-			r = rcu_dereference(r->u.dst.rt_next);
-		}
-		rcu_read_unlock_bh();
-	}
-	return r;
-}
-
-static struct rtable *__rt_cache_get_next(struct seq_file *seq,
-					  struct rtable *r)
-{
-	struct rt_cache_iter_state *st = seq->private;
-
-	r = r->u.dst.rt_next;
-	while (!r) {
-		rcu_read_unlock_bh();
-		do {
-			if (--st->bucket < 0)
-				return NULL;
-		} while (!rt_hash_table[st->bucket].chain);
-		rcu_read_lock_bh();
-		r = rt_hash_table[st->bucket].chain;
-	}
-	return rcu_dereference(r);
-}
-
-static struct rtable *rt_cache_get_next(struct seq_file *seq,
-					struct rtable *r)
-{
-	struct rt_cache_iter_state *st = seq->private;
-	while ((r = __rt_cache_get_next(seq, r)) != NULL) {
-		if (dev_net(r->u.dst.dev) != seq_file_net(seq))
-			continue;
-		if (r->rt_genid == st->genid)
-			break;
-	}
-	return r;
-}
-
-static struct rtable *rt_cache_get_idx(struct seq_file *seq, loff_t pos)
-{
-	struct rtable *r = rt_cache_get_first(seq);
-
-	if (r)
-		while (pos && (r = rt_cache_get_next(seq, r)))
-			--pos;
-	return pos ? NULL : r;
-}
-
+/*
+ * Routes no longer live in a global table, so there is nothing to list;
+ * the header is kept for the tools that parse this file.
+ */
 static void *rt_cache_seq_start(struct seq_file *seq, loff_t *pos)
 {
-	struct rt_cache_iter_state *st = seq->private;
 	if (*pos)
-		return rt_cache_get_idx(seq, *pos - 1);
-	st->genid = rt_genid(seq_file_net(seq));
+		return NULL;
 	return SEQ_START_TOKEN;
 }
 
 static void *rt_cache_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
-	struct rtable *r;
-
-	if (v == SEQ_START_TOKEN)
-		r = rt_cache_get_first(seq);
-	else
-		r = rt_cache_get_next(seq, v);
 	++*pos;
-	return r;
+	return NULL;
 }
 
 static void rt_cache_seq_stop(struct seq_file *seq, void *v)
 {
-	if (v && v != SEQ_START_TOKEN)
-		rcu_read_unlock_bh();
 }
 
 static int rt_cache_seq_show(struct seq_file *seq, void *v)
@@ -374,29 +255,6 @@ static int rt_cache_seq_show(struct seq_file *seq, void *v)
 			   "Iface\tDestination\tGateway \tFlags\t\tRefCnt\tUse\t"
 			   "Metric\tSource\t\tMTU\tWindow\tIRTT\tTOS\tHHRef\t"
 			   "HHUptod\tSpecDst");
-	else {
-		struct rtable *r = v;
-		int len;
-
-		seq_printf(seq, "%s\t%08lX\t%08lX\t%8X\t%d\t%u\t%d\t"
-			      "%08lX\t%d\t%u\t%u\t%02X\t%d\t%1d\t%08X%n",
-			r->u.dst.dev ? r->u.dst.dev->name : "*",
-			(unsigned long)r->rt_dst, (unsigned long)r->rt_gateway,
-			r->rt_flags, atomic_read(&r->u.dst.__refcnt),
-			r->u.dst.__use, 0, (unsigned long)r->rt_src,
-			(dst_metric(&r->u.dst, RTAX_ADVMSS) ?
-			     (int)dst_metric(&r->u.dst, RTAX_ADVMSS) + 40 : 0),
-			dst_metric(&r->u.dst, RTAX_WINDOW),
-			(int)((dst_metric(&r->u.dst, RTAX_RTT) >> 3) +
-			      dst_metric(&r->u.dst, RTAX_RTTVAR)),
-			r->fl.fl4_tos,
-			r->u.dst.hh ? atomic_read(&r->u.dst.hh->hh_refcnt) : -1,
-			r->u.dst.hh ? (r->u.dst.hh->hh_output ==
-				       dev_queue_xmit) : 0,
-			r->rt_spec_dst, &len);
-
-		seq_printf(seq, "%*s\n", 127 - len, "");
-	}
 	return 0;
 }
 
@@ -410,7 +268,7 @@ static const struct seq_operations rt_cache_seq_ops = {
 static int rt_cache_seq_open(struct inode *inode, struct file *file)
 {
 	return seq_open_net(inode, file, &rt_cache_seq_ops,
-			sizeof(struct rt_cache_iter_state));
+			sizeof(struct seq_net_private));
 }
 
 static const struct file_operations rt_cache_seq_fops = {
@@ -619,75 +477,116 @@ static inline void rt_drop(struct rtable *rt)
 	call_rcu_bh(&rt->u.dst.rcu_head, dst_rcu_free);
 }
 
-static inline int rt_fast_clean(struct rtable *rth)
-{
-	/* Kill broadcast/multicast entries very aggresively, if they
-	   collide in hash table with more useful entries */
-	return (rth->rt_flags & (RTCF_BROADCAST | RTCF_MULTICAST)) &&
-		rth->fl.iif && rth->u.dst.rt_next;
-}
+/*
+ * Output routes that lost their slot but may still be in use, chained
+ * through u.dst.rt_next on the list of the cpu that displaced them.
+ * Entries nobody holds any more are reaped every ip_rt_gc_interval.
+ */
+struct rt_uncached_list {
+	spinlock_t		lock;
+	struct rtable		*head;
+};
+
+static DEFINE_PER_CPU(struct rt_uncached_list, rt_uncached_list);
+
+static void rt_uncached_reap(unsigned long dummy);
+static DEFINE_TIMER(rt_uncached_timer, rt_uncached_reap, 0, 0);
 
-static inline int rt_valuable(struct rtable *rth)
+static void rt_free_chain(struct rtable *rt)
 {
-	return (rth->rt_flags & (RTCF_REDIRECTED | RTCF_NOTIFY)) ||
-		rth->u.dst.expires;
+	while (rt) {
+		struct rtable *next = rt->u.dst.rt_next;
+
+		dst_free(&rt->u.dst);
+		rt = next;
+	}
 }
 
-static int rt_may_expire(struct rtable *rth, unsigned long tmo1, unsigned long tmo2)
+/*
+ * Runs once the route can no longer be found through its slot, so a zero
+ * refcount means nobody will ever take a reference on it again.
+ */
+static void rt_uncache_rcu(struct rcu_head *head)
 {
-	unsigned long age;
-	int ret = 0;
+	struct rtable *rt = container_of(head, struct rtable, u.dst.rcu_head);
+	struct rt_uncached_list *ul;
 
-	if (atomic_read(&rth->u.dst.__refcnt))
-		goto out;
+	if (!atomic_read(&rt->u.dst.__refcnt)) {
+		dst_free(&rt->u.dst);
+		return;
+	}
 
-	ret = 1;
-	if (rth->u.dst.expires &&
-	    time_after_eq(jiffies, rth->u.dst.expires))
-		goto out;
+	ul = &__get_cpu_var(rt_uncached_list);
+	spin_lock(&ul->lock);
+	rt->u.dst.rt_next = ul->head;
+	ul->head = rt;
+	spin_unlock(&ul->lock);
 
-	age = jiffies - rth->u.dst.lastuse;
-	ret = 0;
-	if ((age <= tmo1 && !rt_fast_clean(rth)) ||
-	    (age <= tmo2 && rt_valuable(rth)))
-		goto out;
-	ret = 1;
-out:	return ret;
+	if (!timer_pending(&rt_uncached_timer))
+		mod_timer(&rt_uncached_timer, jiffies + ip_rt_gc_interval);
 }
 
-/* Bits of score are:
- * 31: very valuable
- * 30: not quite useless
- * 29..0: usage counter
+/*
+ * Unlink the routes of @ul that belong to @net (any if NULL), or only
+ * those nobody holds any more if @unused, and return them as a chain.
+ * Called with ul->lock held.
  */
-static inline u32 rt_score(struct rtable *rt)
-{
-	u32 score = jiffies - rt->u.dst.lastuse;
+static struct rtable *rt_uncached_unlink(struct rt_uncached_list *ul,
+					 struct net *net, int unused)
+{
+	struct rtable *rt, **rtp, *dead = NULL;
+
+	rtp = &ul->head;
+	while ((rt = *rtp) != NULL) {
+		if ((!net || net_eq(dev_net(rt->u.dst.dev), net)) &&
+		    (!unused || !atomic_read(&rt->u.dst.__refcnt))) {
+			*rtp = rt->u.dst.rt_next;
+			rt->u.dst.rt_next = dead;
+			dead = rt;
+		} else
+			rtp = &rt->u.dst.rt_next;
+	}
+	return dead;
+}
 
-	score = ~score & ~(3<<30);
+static void rt_uncached_reap(unsigned long dummy)
+{
+	int cpu, pending = 0;
 
-	if (rt_valuable(rt))
-		score |= (1<<31);
+	for_each_possible_cpu(cpu) {
+		struct rt_uncached_list *ul = &per_cpu(rt_uncached_list, cpu);
+		struct rtable *dead;
 
-	if (!rt->fl.iif ||
-	    !(rt->rt_flags & (RTCF_BROADCAST|RTCF_MULTICAST|RTCF_LOCAL)))
-		score |= (1<<30);
+		spin_lock(&ul->lock);
+		dead = rt_uncached_unlink(ul, NULL, 1);
+		if (ul->head)
+			pending = 1;
+		spin_unlock(&ul->lock);
 
-	return score;
+		rt_free_chain(dead);
+	}
+	if (pending)
+		mod_timer(&rt_uncached_timer, jiffies + ip_rt_gc_interval);
 }
 
-static inline bool rt_caching(const struct net *net)
+/*
+ * Kill the uncached routes of @net, on a FIB change or a device event.
+ * Their holders find out through ipv4_dst_check().
+ */
+static void rt_uncached_flush(struct net *net)
 {
-	return net->ipv4.current_rt_cache_rebuild_count <=
-		net->ipv4.sysctl_rt_cache_rebuild_count;
-}
+	int cpu;
 
-static inline bool compare_hash_inputs(const struct flowi *fl1,
-					const struct flowi *fl2)
-{
-	return (__force u32)(((fl1->nl_u.ip4_u.daddr ^ fl2->nl_u.ip4_u.daddr) |
-		(fl1->nl_u.ip4_u.saddr ^ fl2->nl_u.ip4_u.saddr) |
-		(fl1->iif ^ fl2->iif)) == 0);
+	for_each_possible_cpu(cpu) {
+		struct rt_uncached_list *ul = &per_cpu(rt_uncached_list, cpu);
+		struct rtable *dead;
+
+		spin_lock_bh(&ul->lock);
+		dead = rt_uncached_unlink(ul, net, 0);
+		spin_unlock_bh(&ul->lock);
+
+		rt_free_chain(dead);
+	}
 }
 
 static inline int compare_keys(struct flowi *fl1, struct flowi *fl2)
@@ -701,9 +600,16 @@ static inline int compare_keys(struct flowi *fl1, struct flowi *fl2)
 		(fl1->iif ^ fl2->iif)) == 0;
 }
 
-static inline int compare_netns(struct rtable *rt1, struct rtable *rt2)
+static inline int compare_output_keys(const struct flowi *fl1,
+				      const struct flowi *fl2)
 {
-	return dev_net(rt1->u.dst.dev) == dev_net(rt2->u.dst.dev);
+	return fl1->fl4_dst == fl2->fl4_dst &&
+	       fl1->fl4_src == fl2->fl4_src &&
+	       fl1->iif == 0 &&
+	       fl1->oif == fl2->oif &&
+	       fl1->mark == fl2->mark &&
+	       !((fl1->fl4_tos ^ fl2->fl4_tos) &
+		 (IPTOS_RT_MASK | RTO_ONLINK));
 }
 
 static inline int rt_is_expired(struct rtable *rth)
@@ -711,527 +617,550 @@ static inline int rt_is_expired(struct rtable *rth)
 	return rth->rt_genid != rt_genid(dev_net(rth->u.dst.dev));
 }
 
+/* A learnt PMTU, or a link failure, has run out on this route. */
+static inline int rt_dst_expired(struct rtable *rth)
+{
+	return rth->u.dst.expires &&
+	       time_after_eq(jiffies, rth->u.dst.expires);
+}
+
+static inline int rt_usable(struct rtable *rth, struct net *net)
+{
+	return net_eq(dev_net(rth->u.dst.dev), net) &&
+	       !rt_is_expired(rth) && !rt_dst_expired(rth);
+}
+
 /*
- * Perform a full scan of hash table and free all entries.
- * Can be called by a softirq or a process.
- * In the later case, we want to be reschedule if necessary
+ * Pertubation of rt_genid by a small quantity [1..256]
+ * Using 8 bits of shuffling ensure we can call rt_cache_invalidate()
+ * many times (2^24) without giving recent rt_genid.
  */
-static void rt_do_flush(int process_context)
+static void rt_cache_invalidate(struct net *net)
 {
-	unsigned int i;
-	struct rtable *rth, *next;
-	struct rtable * tail;
-
-	for (i = 0; i <= rt_hash_mask; i++) {
-		if (process_context && need_resched())
-			cond_resched();
-		rth = rt_hash_table[i].chain;
-		if (!rth)
-			continue;
+	unsigned char shuffle;
 
-		spin_lock_bh(rt_hash_lock_addr(i));
-#ifdef CONFIG_NET_NS
-		{
-		struct rtable ** prev, * p;
+	get_random_bytes(&shuffle, sizeof(shuffle));
+	atomic_add(shuffle + 1U, &net->ipv4.rt_genid);
+}
 
-		rth = rt_hash_table[i].chain;
+/*
+ * Cached routes are checked against rt_genid when they are used, so a
+ * flush is just a generation bump: stale entries get replaced in place,
+ * or released along with their fib_info.  The uncached ones are released
+ * right away, so that they don't pin devices on their way out.  The delay
+ * no longer matters.
+ */
+void rt_cache_flush(struct net *net, int delay)
+{
+	rt_cache_invalidate(net);
+	rt_uncached_flush(net);
+}
 
-		/* defer releasing the head of the list after spin_unlock */
-		for (tail = rth; tail; tail = tail->u.dst.rt_next)
-			if (!rt_is_expired(tail))
-				break;
-		if (rth != tail)
-			rt_hash_table[i].chain = tail;
-
-		/* call rt_free on entries after the tail requiring flush */
-		prev = &rt_hash_table[i].chain;
-		for (p = *prev; p; p = next) {
-			next = p->u.dst.rt_next;
-			if (!rt_is_expired(p)) {
-				prev = &p->u.dst.rt_next;
-			} else {
-				*prev = next;
-				rt_free(p);
-			}
-		}
-		}
-#else
-		rth = rt_hash_table[i].chain;
-		rt_hash_table[i].chain = NULL;
-		tail = NULL;
-#endif
-		spin_unlock_bh(rt_hash_lock_addr(i));
+static inline unsigned int rt_input_hash(__be32 daddr, __be32 saddr, int iif)
+{
+	return jhash_3words((__force u32)daddr, (__force u32)saddr, iif,
+			    rt_cache_rnd) & (RT_INPUT_BUCKETS - 1);
+}
 
-		for (; rth != tail; rth = next) {
-			next = rth->u.dst.rt_next;
-			rt_free(rth);
-		}
-	}
+/* Only the destination is hashed, see rt_invalidate_dst(). */
+static inline unsigned int rt_output_hash(__be32 daddr)
+{
+	return jhash_1word((__force u32)daddr, rt_cache_rnd) &
+		(RT_OUTPUT_SLOTS - 1);
 }
 
 /*
- * While freeing expired entries, we compute average chain length
- * and standard deviation, using fixed-point arithmetic.
- * This to have an estimation of rt_chain_length_max
- *  rt_chain_length_max = max(elasticity, AVG + 4*SD)
- * We use 3 bits for frational part, and 29 (or 61) for magnitude.
+ * Slot tables are only allocated for fib_infos that actually get used,
+ * most of the local and broadcast ones never are.
  */
+static struct rtable **rt_slot_table(struct rtable ***tablep, size_t size)
+{
+	struct rtable **table = rcu_dereference(*tablep);
+
+	if (unlikely(!table)) {
+		struct rtable **new = kzalloc(size, GFP_ATOMIC);
 
-#define FRACT_BITS 3
-#define ONE (1UL << FRACT_BITS)
+		if (!new)
+			return NULL;
+		table = cmpxchg(tablep, NULL, new);
+		if (table)
+			kfree(new);
+		else
+			table = new;
+	}
+	return table;
+}
 
-static void rt_check_expire(void)
+/*
+ * Return the first of the RT_INPUT_WAYS slots of the bucket.
+ * Caller holds rcu_read_lock_bh() and a reference on @fi.
+ */
+static struct rtable **rt_input_bucket(struct fib_info *fi, __be32 daddr,
+				       __be32 saddr, int iif)
 {
-	static unsigned int rover;
-	unsigned int i = rover, goal;
-	struct rtable *rth, **rthp;
-	unsigned long length = 0, samples = 0;
-	unsigned long sum = 0, sum2 = 0;
-	u64 mult;
+	struct rtable **table;
 
-	mult = ((u64)ip_rt_gc_interval) << rt_hash_log;
-	if (ip_rt_gc_timeout > 1)
-		do_div(mult, ip_rt_gc_timeout);
-	goal = (unsigned int)mult;
-	if (goal > rt_hash_mask)
-		goal = rt_hash_mask + 1;
-	length = 0;
-	for (; goal > 0; goal--) {
-		unsigned long tmo = ip_rt_gc_timeout;
+	table = rt_slot_table(&fi->fib_rth_input,
+			      RT_INPUT_BUCKETS * RT_INPUT_WAYS *
+			      sizeof(struct rtable *));
+	if (!table)
+		return NULL;
+	return &table[rt_input_hash(daddr, saddr, iif) * RT_INPUT_WAYS];
+}
 
-		i = (i + 1) & rt_hash_mask;
-		rthp = &rt_hash_table[i].chain;
+/* Same as above, the slot is in the row of the current cpu. */
+static struct rtable **rt_output_slot(struct fib_info *fi, __be32 daddr)
+{
+	struct rtable **table;
 
-		if (need_resched())
-			cond_resched();
+	table = rt_slot_table(&fi->fib_rth_output,
+			      nr_cpu_ids * RT_OUTPUT_SLOTS *
+			      sizeof(struct rtable *));
+	if (!table)
+		return NULL;
+	return &table[smp_processor_id() * RT_OUTPUT_SLOTS +
+		      rt_output_hash(daddr)];
+}
 
-		samples++;
+/*
+ * On a miss, *victim is set to the slot of @bucket the new route should
+ * take: a stale entry for the same flow, a free slot, or else the least
+ * recently used one.
+ */
+static struct rtable *rt_input_lookup(struct rtable **bucket,
+				      struct flowi *fl, struct net *net,
+				      struct rtable ***victim)
+{
+	struct rtable **lru = NULL, *lru_rt = NULL;
+	int i;
 
-		if (*rthp == NULL)
-			continue;
-		spin_lock_bh(rt_hash_lock_addr(i));
-		while ((rth = *rthp) != NULL) {
-			if (rt_is_expired(rth)) {
-				*rthp = rth->u.dst.rt_next;
-				rt_free(rth);
-				continue;
-			}
-			if (rth->u.dst.expires) {
-				/* Entry is expired even if it is in use */
-				if (time_before_eq(jiffies, rth->u.dst.expires)) {
-					tmo >>= 1;
-					rthp = &rth->u.dst.rt_next;
-					/*
-					 * Only bump our length if the hash
-					 * inputs on entries n and n+1 are not
-					 * the same, we only count entries on
-					 * a chain with equal hash inputs once
-					 * so that entries for different QOS
-					 * levels, and other non-hash input
-					 * attributes don't unfairly skew
-					 * the length computation
-					 */
-					if ((*rthp == NULL) ||
-					    !compare_hash_inputs(&(*rthp)->fl,
-								 &rth->fl))
-						length += ONE;
-					continue;
-				}
-			} else if (!rt_may_expire(rth, tmo, ip_rt_gc_timeout)) {
-				tmo >>= 1;
-				rthp = &rth->u.dst.rt_next;
-				if ((*rthp == NULL) ||
-				    !compare_hash_inputs(&(*rthp)->fl,
-							 &rth->fl))
-					length += ONE;
-				continue;
-			}
+	for (i = 0; i < RT_INPUT_WAYS; i++) {
+		struct rtable *rth = rcu_dereference(bucket[i]);
 
-			/* Cleanup aged off entries. */
-			*rthp = rth->u.dst.rt_next;
-			rt_free(rth);
+		if (rth && compare_keys(&rth->fl, fl)) {
+			if (rt_usable(rth, net)) {
+				dst_use(&rth->u.dst, jiffies);
+				RT_CACHE_STAT_INC(in_hit);
+				return rth;
+			}
+			lru = &bucket[i];
+			break;
+		}
+		if (!lru || (lru_rt && (!rth ||
+				       time_before(rth->u.dst.lastuse,
+						   lru_rt->u.dst.lastuse)))) {
+			lru = &bucket[i];
+			lru_rt = rth;
 		}
-		spin_unlock_bh(rt_hash_lock_addr(i));
-		sum += length;
-		sum2 += length*length;
 	}
-	if (samples) {
-		unsigned long avg = sum / samples;
-		unsigned long sd = int_sqrt(sum2 / samples - avg*avg);
-		rt_chain_length_max = max_t(unsigned long,
-					ip_rt_gc_elasticity,
-					(avg + 4*sd) >> FRACT_BITS);
+	*victim = lru;
+	return NULL;
+}
+
+static struct rtable *rt_output_lookup(struct rtable **slot,
+				       const struct flowi *flp,
+				       struct net *net)
+{
+	struct rtable *rth = rcu_dereference(*slot);
+
+	if (rth && compare_output_keys(&rth->fl, flp) && rt_usable(rth, net)) {
+		dst_use(&rth->u.dst, jiffies);
+		RT_CACHE_STAT_INC(out_hit);
+		return rth;
 	}
-	rover = i;
+	return NULL;
 }
 
 /*
- * rt_worker_func() is run in process context.
- * we call rt_check_expire() to scan part of the hash table
+ * Put @rt in @slot.  A displaced output route moves to the uncached list,
+ * see the comment at the top.
  */
-static void rt_worker_func(struct work_struct *work)
+static void rt_slot_store(struct rtable **slot, struct rtable *rt)
 {
-	rt_check_expire();
-	schedule_delayed_work(&expires_work, ip_rt_gc_interval);
+	struct rtable *orig = xchg(slot, rt);
+
+	if (!orig)
+		return;
+	if (orig->fl.iif)
+		rt_free(orig);
+	else
+		call_rcu_bh(&orig->u.dst.rcu_head, rt_uncache_rcu);
 }
 
 /*
- * Pertubation of rt_genid by a small quantity [1..256]
- * Using 8 bits of shuffling ensure we can call rt_cache_invalidate()
- * many times (2^24) without giving recent rt_genid.
- * Jenkins hash is strong enough that litle changes of rt_genid are OK.
+ * Hand a freshly built route over to the caller.  With a slot it is
+ * cached there; otherwise it goes onto the dst garbage list right away
+ * and is freed once the caller is done with it.
  */
-static void rt_cache_invalidate(struct net *net)
+static int rt_finish(struct rtable *rt, struct rtable **slot,
+		     struct rtable **rp)
 {
-	unsigned char shuffle;
+	/* Try to bind route to arp only if it is output
+	   route or unicast forwarding path.
+	 */
+	if (rt->rt_type == RTN_UNICAST || rt->fl.iif == 0) {
+		int err = arp_bind_neighbour(&rt->u.dst);
+		if (err) {
+			if (err == -ENOBUFS && net_ratelimit())
+				printk(KERN_WARNING "Neighbour table overflow.\n");
+			rt_drop(rt);
+			return err;
+		}
+	}
 
-	get_random_bytes(&shuffle, sizeof(shuffle));
-	atomic_add(shuffle + 1U, &net->ipv4.rt_genid);
+	if (slot)
+		rt_slot_store(slot, rt);
+	else
+		dst_free(&rt->u.dst);
+	*rp = rt;
+	return 0;
 }
 
 /*
- * delay < 0  : invalidate cache (fast : entries will be deleted later)
- * delay >= 0 : invalidate & flush cache (can be long)
+ * Drop the output routes to @daddr cached on @fi, on every cpu, so that
+ * the next lookup picks up a changed exception.  Sockets holding one of
+ * them find out through ipv4_dst_check() once it has been freed.  Routes
+ * already on the uncached lists are left alone, see the comment at the
+ * top: the work done here must not grow with the number of flows.
  */
-void rt_cache_flush(struct net *net, int delay)
+static void rt_invalidate_dst(struct fib_info *fi, __be32 daddr)
 {
-	rt_cache_invalidate(net);
-	if (delay >= 0)
-		rt_do_flush(!in_softirq());
+	unsigned int hash = rt_output_hash(daddr);
+	struct rtable **table;
+	int cpu;
+
+	rcu_read_lock_bh();
+	table = rcu_dereference(fi->fib_rth_output);
+	if (table) {
+		for_each_possible_cpu(cpu) {
+			struct rtable **slot = &table[cpu * RT_OUTPUT_SLOTS +
+						      hash];
+			struct rtable *rt = rcu_dereference(*slot);
+
+			if (rt && rt->fl.fl4_dst == daddr &&
+			    cmpxchg(slot, rt, NULL) == rt)
+				rt_free(rt);
+		}
+	}
+	rcu_read_unlock_bh();
+}
+
+/* Return a reference to some output route to @daddr cached on @fi. */
+static struct rtable *rt_cached_output(struct fib_info *fi, __be32 daddr)
+{
+	unsigned int hash = rt_output_hash(daddr);
+	struct rtable *found = NULL;
+	struct rtable **table;
+	int cpu;
+
+	rcu_read_lock_bh();
+	table = rcu_dereference(fi->fib_rth_output);
+	if (table) {
+		for_each_possible_cpu(cpu) {
+			struct rtable *rt;
+
+			rt = rcu_dereference(table[cpu * RT_OUTPUT_SLOTS +
+						   hash]);
+			if (rt && rt->fl.fl4_dst == daddr && !rt_is_expired(rt)) {
+				dst_hold(&rt->u.dst);
+				found = rt;
+				break;
+			}
+		}
+	}
+	rcu_read_unlock_bh();
+	return found;
 }
 
 /*
- * We change rt_genid and let gc do the cleanup
+ * Nexthop exceptions.
+ *
+ * Entries are never unlinked while their fib_info is alive: chains are
+ * kept short by recycling the oldest entry in place, so ICMP can't grow
+ * the table without bound, and readers need nothing more than the
+ * fib_info reference they already hold.
  */
-static void rt_secret_rebuild(unsigned long __net)
+
+static DEFINE_SPINLOCK(fnhe_lock);
+
+static inline u32 fnhe_hashfun(__be32 daddr)
 {
-	struct net *net = (struct net *)__net;
-	rt_cache_invalidate(net);
-	mod_timer(&net->ipv4.rt_secret_timer, jiffies + ip_rt_secret_interval);
+	u32 hval = (__force u32)daddr;
+
+	hval ^= (hval >> 11) ^ (hval >> 22);
+	return hval & (FNHE_HASH_SIZE - 1);
 }
 
-static void rt_secret_rebuild_oneshot(struct net *net)
+static struct fib_nh_exception *find_exception(struct fib_nh *nh,
+					       __be32 daddr)
 {
-	del_timer_sync(&net->ipv4.rt_secret_timer);
-	rt_cache_invalidate(net);
-	if (ip_rt_secret_interval) {
-		net->ipv4.rt_secret_timer.expires += ip_rt_secret_interval;
-		add_timer(&net->ipv4.rt_secret_timer);
+	struct fnhe_hash_bucket *hash = rcu_dereference(nh->nh_exceptions);
+	struct fib_nh_exception *fnhe;
+
+	if (!hash)
+		return NULL;
+
+	for (fnhe = rcu_dereference(hash[fnhe_hashfun(daddr)].chain); fnhe;
+	     fnhe = rcu_dereference(fnhe->fnhe_next)) {
+		if (fnhe->fnhe_daddr == daddr)
+			return fnhe;
 	}
+	return NULL;
 }
 
-static void rt_emergency_hash_rebuild(struct net *net)
+static struct fib_nh_exception *fnhe_oldest(struct fnhe_hash_bucket *hash)
 {
-	if (net_ratelimit()) {
-		printk(KERN_WARNING "Route hash chain too long!\n");
-		printk(KERN_WARNING "Adjust your secret_interval!\n");
-	}
+	struct fib_nh_exception *fnhe, *oldest;
 
-	rt_secret_rebuild_oneshot(net);
+	oldest = hash->chain;
+	for (fnhe = oldest->fnhe_next; fnhe; fnhe = fnhe->fnhe_next) {
+		if (time_before(fnhe->fnhe_stamp, oldest->fnhe_stamp))
+			oldest = fnhe;
+	}
+	return oldest;
 }
 
 /*
-   Short description of GC goals.
-
-   We want to build algorithm, which will keep routing cache
-   at some equilibrium point, when number of aged off entries
-   is kept approximately equal to newly generated ones.
-
-   Current expiration strength is variable "expire".
-   We try to adjust it dynamically, so that if networking
-   is idle expires is large enough to keep enough of warm entries,
-   and when load increases it reduces to limit cache size.
+ * Record a new gateway (@gw != 0) and/or path MTU (@pmtu != 0) for
+ * @daddr behind @nh.
  */
-
-static int rt_garbage_collect(struct dst_ops *ops)
+static void update_or_create_fnhe(struct fib_nh *nh, __be32 daddr,
+				  __be32 gw, u32 pmtu, int mtu_locked,
+				  unsigned long expires)
 {
-	static unsigned long expire = RT_GC_TIMEOUT;
-	static unsigned long last_gc;
-	static int rover;
-	static int equilibrium;
-	struct rtable *rth, **rthp;
-	unsigned long now = jiffies;
-	int goal;
+	struct fnhe_hash_bucket *hash;
+	struct fib_nh_exception *fnhe;
+	int depth = 0;
 
-	/*
-	 * Garbage collection is pretty expensive,
-	 * do not make it too frequently.
-	 */
+	spin_lock_bh(&fnhe_lock);
 
-	RT_CACHE_STAT_INC(gc_total);
+	hash = nh->nh_exceptions;
+	if (!hash) {
+		hash = kzalloc(FNHE_HASH_SIZE * sizeof(*hash), GFP_ATOMIC);
+		if (!hash)
+			goto out_unlock;
+		rcu_assign_pointer(nh->nh_exceptions, hash);
+	}
+	hash += fnhe_hashfun(daddr);
 
-	if (now - last_gc < ip_rt_gc_min_interval &&
-	    atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size) {
-		RT_CACHE_STAT_INC(gc_ignored);
-		goto out;
+	for (fnhe = hash->chain; fnhe; fnhe = fnhe->fnhe_next) {
+		if (fnhe->fnhe_daddr == daddr)
+			break;
+		depth++;
 	}
 
-	/* Calculate number of entries, which we want to expire now. */
-	goal = atomic_read(&ipv4_dst_ops.entries) -
-		(ip_rt_gc_elasticity << rt_hash_log);
-	if (goal <= 0) {
-		if (equilibrium < ipv4_dst_ops.gc_thresh)
-			equilibrium = ipv4_dst_ops.gc_thresh;
-		goal = atomic_read(&ipv4_dst_ops.entries) - equilibrium;
-		if (goal > 0) {
-			equilibrium += min_t(unsigned int, goal >> 1, rt_hash_mask + 1);
-			goal = atomic_read(&ipv4_dst_ops.entries) - equilibrium;
+	if (fnhe) {
+		if (gw)
+			fnhe->fnhe_gw = gw;
+		if (pmtu) {
+			fnhe->fnhe_pmtu = pmtu;
+			fnhe->fnhe_mtu_locked = mtu_locked;
+			fnhe->fnhe_expires = expires;
 		}
+	} else if (depth > FNHE_RECLAIM_DEPTH) {
+		fnhe = fnhe_oldest(hash);
+		fnhe->fnhe_daddr = daddr;
+		fnhe->fnhe_gw = gw;
+		fnhe->fnhe_pmtu = pmtu;
+		fnhe->fnhe_mtu_locked = mtu_locked;
+		fnhe->fnhe_expires = expires;
 	} else {
-		/* We are in dangerous area. Try to reduce cache really
-		 * aggressively.
-		 */
-		goal = max_t(unsigned int, goal >> 1, rt_hash_mask + 1);
-		equilibrium = atomic_read(&ipv4_dst_ops.entries) - goal;
-	}
-
-	if (now - last_gc >= ip_rt_gc_min_interval)
-		last_gc = now;
+		fnhe = kzalloc(sizeof(*fnhe), GFP_ATOMIC);
+		if (!fnhe)
+			goto out_unlock;
+		fnhe->fnhe_next = hash->chain;
+		fnhe->fnhe_daddr = daddr;
+		fnhe->fnhe_gw = gw;
+		fnhe->fnhe_pmtu = pmtu;
+		fnhe->fnhe_mtu_locked = mtu_locked;
+		fnhe->fnhe_expires = expires;
+		rcu_assign_pointer(hash->chain, fnhe);
+	}
+	fnhe->fnhe_stamp = jiffies;
+
+out_unlock:
+	spin_unlock_bh(&fnhe_lock);
+}
+
+/* Apply what we know about @daddr to a route being built for it. */
+static void rt_bind_exception(struct rtable *rt, struct fib_nh_exception *fnhe,
+			      __be32 daddr)
+{
+	/* update_or_create_fnhe() may recycle the entry for another daddr */
+	spin_lock_bh(&fnhe_lock);
+	if (fnhe->fnhe_daddr != daddr)
+		goto out;
 
-	if (goal <= 0) {
-		equilibrium += goal;
-		goto work_done;
+	if (fnhe->fnhe_pmtu) {
+		unsigned long expires = fnhe->fnhe_expires;
+
+		if (time_before(jiffies, expires)) {
+			if (fnhe->fnhe_pmtu < dst_mtu(&rt->u.dst) &&
+			    !dst_metric_locked(&rt->u.dst, RTAX_MTU)) {
+				rt->u.dst.metrics[RTAX_MTU-1] = fnhe->fnhe_pmtu;
+				if (fnhe->fnhe_mtu_locked)
+					rt->u.dst.metrics[RTAX_LOCK-1] |=
+						(1 << RTAX_MTU);
+				rt->u.dst.expires = expires;
+			}
+		} else
+			fnhe->fnhe_pmtu = 0;
 	}
 
-	do {
-		int i, k;
-
-		for (i = rt_hash_mask, k = rover; i >= 0; i--) {
-			unsigned long tmo = expire;
-
-			k = (k + 1) & rt_hash_mask;
-			rthp = &rt_hash_table[k].chain;
-			spin_lock_bh(rt_hash_lock_addr(k));
-			while ((rth = *rthp) != NULL) {
-				if (!rt_is_expired(rth) &&
-					!rt_may_expire(rth, tmo, expire)) {
-					tmo >>= 1;
-					rthp = &rth->u.dst.rt_next;
-					continue;
-				}
-				*rthp = rth->u.dst.rt_next;
-				rt_free(rth);
-				goal--;
-			}
-			spin_unlock_bh(rt_hash_lock_addr(k));
-			if (goal <= 0)
-				break;
-		}
-		rover = k;
+	if (fnhe->fnhe_gw) {
+		rt->rt_gateway = fnhe->fnhe_gw;
+		rt->rt_flags |= RTCF_REDIRECTED;
+	}
+out:
+	spin_unlock_bh(&fnhe_lock);
+}
 
-		if (goal <= 0)
-			goto work_done;
+/* The first hop currently used for @daddr through @nh. */
+static __be32 rt_nh_gateway(struct fib_nh *nh, __be32 daddr)
+{
+	struct fib_nh_exception *fnhe;
+	__be32 gw = daddr;
 
-		/* Goal is not achieved. We stop process if:
+	if (nh->nh_gw && nh->nh_scope == RT_SCOPE_LINK)
+		gw = nh->nh_gw;
 
-		   - if expire reduced to zero. Otherwise, expire is halfed.
-		   - if table is not full.
-		   - if we are called from interrupt.
-		   - jiffies check is just fallback/debug loop breaker.
-		     We will not spin here for long time in any case.
-		 */
+	spin_lock_bh(&fnhe_lock);
+	fnhe = find_exception(nh, daddr);
+	if (fnhe && fnhe->fnhe_gw)
+		gw = fnhe->fnhe_gw;
+	spin_unlock_bh(&fnhe_lock);
+	return gw;
+}
 
-		RT_CACHE_STAT_INC(gc_goal_miss);
+/* The path MTU a route to @daddr through @res would get. */
+static unsigned int rt_fib_mtu(struct fib_result *res, __be32 daddr)
+{
+	struct fib_nh *nh = &FIB_RES_NH(*res);
+	struct fib_nh_exception *fnhe;
+	unsigned int mtu;
 
-		if (expire == 0)
-			break;
+	mtu = res->fi->fib_mtu ? : nh->nh_dev->mtu;
 
-		expire >>= 1;
-#if RT_CACHE_DEBUG >= 2
-		printk(KERN_DEBUG "expire>> %u %d %d %d\n", expire,
-				atomic_read(&ipv4_dst_ops.entries), goal, i);
-#endif
+	spin_lock_bh(&fnhe_lock);
+	fnhe = find_exception(nh, daddr);
+	if (fnhe && fnhe->fnhe_pmtu && fnhe->fnhe_pmtu < mtu &&
+	    time_before(jiffies, fnhe->fnhe_expires))
+		mtu = fnhe->fnhe_pmtu;
+	spin_unlock_bh(&fnhe_lock);
+	return mtu;
+}
 
-		if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
-			goto out;
-	} while (!in_softirq() && time_before_eq(jiffies, now));
+/*
+ * Find the unicast fib_info output traffic to @daddr would use.
+ * On success the caller owns a reference on res->fi.
+ */
+static int rt_output_fib_lookup(struct net *net, __be32 daddr, __be32 saddr,
+				u8 tos, u32 mark, struct fib_result *res)
+{
+	struct flowi fl = { .nl_u = { .ip4_u =
+				      { .daddr = daddr,
+					.saddr = saddr,
+					.tos = tos & IPTOS_RT_MASK,
+					.scope = RT_SCOPE_UNIVERSE,
+				      } },
+			    .mark = mark,
+			    .iif = net->loopback_dev->ifindex };
 
-	if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
-		goto out;
-	if (net_ratelimit())
-		printk(KERN_WARNING "dst cache overflow\n");
-	RT_CACHE_STAT_INC(gc_dst_overflow);
-	return 1;
-
-work_done:
-	expire += ip_rt_gc_min_interval;
-	if (expire > ip_rt_gc_timeout ||
-	    atomic_read(&ipv4_dst_ops.entries) < ipv4_dst_ops.gc_thresh)
-		expire = ip_rt_gc_timeout;
-#if RT_CACHE_DEBUG >= 2
-	printk(KERN_DEBUG "expire++ %u %d %d %d\n", expire,
-			atomic_read(&ipv4_dst_ops.entries), goal, rover);
-#endif
-out:	return 0;
+	if (fib_lookup(net, &fl, res))
+		return -ENETUNREACH;
+	if (res->type != RTN_UNICAST || !res->fi) {
+		fib_res_put(res);
+		return -EINVAL;
+	}
+	return 0;
 }
 
-static int rt_intern_hash(unsigned hash, struct rtable *rt, struct rtable **rp)
+static void rt_learn_pmtu(struct fib_info *fi, __be32 daddr, u32 mtu,
+			  int locked)
 {
-	struct rtable	*rth, **rthp;
-	struct rtable	*rthi;
-	unsigned long	now;
-	struct rtable *cand, **candp;
-	u32 		min_score;
-	int		chain_length;
-	int attempts = !in_softirq();
-
-restart:
-	chain_length = 0;
-	min_score = ~(u32)0;
-	cand = NULL;
-	candp = NULL;
-	now = jiffies;
+	int nhsel;
 
-	if (!rt_caching(dev_net(rt->u.dst.dev))) {
-		rt_drop(rt);
-		return 0;
-	}
+	for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++)
+		update_or_create_fnhe(&fi->fib_nh[nhsel], daddr, 0, mtu, locked,
+				      jiffies + ip_rt_mtu_expires);
+	rt_invalidate_dst(fi, daddr);
+}
 
-	rthp = &rt_hash_table[hash].chain;
-	rthi = NULL;
+/* Forget the redirect and PMTU learnt for the destination of @rt. */
+static void rt_forget_exceptions(struct rtable *rt)
+{
+	struct fib_result res;
+	int nhsel;
 
-	spin_lock_bh(rt_hash_lock_addr(hash));
-	while ((rth = *rthp) != NULL) {
-		if (rt_is_expired(rth)) {
-			*rthp = rth->u.dst.rt_next;
-			rt_free(rth);
-			continue;
-		}
-		if (compare_keys(&rth->fl, &rt->fl) && compare_netns(rth, rt)) {
-			/* Put it first */
-			*rthp = rth->u.dst.rt_next;
-			/*
-			 * Since lookup is lockfree, the deletion
-			 * must be visible to another weakly ordered CPU before
-			 * the insertion at the start of the hash chain.
-			 */
-			rcu_assign_pointer(rth->u.dst.rt_next,
-					   rt_hash_table[hash].chain);
-			/*
-			 * Since lookup is lockfree, the update writes
-			 * must be ordered for consistency on SMP.
-			 */
-			rcu_assign_pointer(rt_hash_table[hash].chain, rth);
+	if (rt->fl.iif ||
+	    rt_output_fib_lookup(dev_net(rt->u.dst.dev), rt->rt_dst,
+				 rt->rt_src, rt->fl.fl4_tos, rt->fl.mark,
+				 &res))
+		return;
 
-			dst_use(&rth->u.dst, now);
-			spin_unlock_bh(rt_hash_lock_addr(hash));
+	spin_lock_bh(&fnhe_lock);
+	for (nhsel = 0; nhsel < res.fi->fib_nhs; nhsel++) {
+		struct fib_nh_exception *fnhe;
 
-			rt_drop(rt);
-			*rp = rth;
-			return 0;
+		fnhe = find_exception(&res.fi->fib_nh[nhsel], rt->rt_dst);
+		if (fnhe) {
+			fnhe->fnhe_gw = 0;
+			fnhe->fnhe_pmtu = 0;
 		}
+	}
+	spin_unlock_bh(&fnhe_lock);
 
-		if (!atomic_read(&rth->u.dst.__refcnt)) {
-			u32 score = rt_score(rth);
+	rt_invalidate_dst(res.fi, rt->rt_dst);
+	fib_res_put(&res);
+}
 
-			if (score <= min_score) {
-				cand = rth;
-				candp = rthp;
-				min_score = score;
-			}
-		}
+static void rt_release_slot(struct rtable **slot)
+{
+	struct rtable *rt = xchg(slot, NULL);
 
-		chain_length++;
+	if (rt)
+		rt_free(rt);
+}
 
-		rthp = &rth->u.dst.rt_next;
+/*
+ * @fi is going away: release the routes cached on it and the exceptions
+ * of its nexthops.  Nobody holds a reference on @fi any more, so there
+ * can't be lookups in flight on these tables.
+ */
+void rt_cache_release(struct fib_info *fi)
+{
+	int i, nhsel;
 
-		/*
-		 * check to see if the next entry in the chain
-		 * contains the same hash input values as rt.  If it does
-		 * This is where we will insert into the list, instead of
-		 * at the head.  This groups entries that differ by aspects not
-		 * relvant to the hash function together, which we use to adjust
-		 * our chain length
-		 */
-		if (*rthp && compare_hash_inputs(&(*rthp)->fl, &rt->fl))
-			rthi = rth;
+	if (fi->fib_rth_input) {
+		for (i = 0; i < RT_INPUT_BUCKETS * RT_INPUT_WAYS; i++)
+			rt_release_slot(&fi->fib_rth_input[i]);
+		kfree(fi->fib_rth_input);
+		fi->fib_rth_input = NULL;
 	}
 
-	if (cand) {
-		/* ip_rt_gc_elasticity used to be average length of chain
-		 * length, when exceeded gc becomes really aggressive.
-		 *
-		 * The second limit is less certain. At the moment it allows
-		 * only 2 entries per bucket. We will see.
-		 */
-		if (chain_length > ip_rt_gc_elasticity) {
-			*candp = cand->u.dst.rt_next;
-			rt_free(cand);
-		}
-	} else {
-		if (chain_length > rt_chain_length_max) {
-			struct net *net = dev_net(rt->u.dst.dev);
-			int num = ++net->ipv4.current_rt_cache_rebuild_count;
-			if (!rt_caching(dev_net(rt->u.dst.dev))) {
-				printk(KERN_WARNING "%s: %d rebuilds is over limit, route caching disabled\n",
-					rt->u.dst.dev->name, num);
-			}
-			rt_emergency_hash_rebuild(dev_net(rt->u.dst.dev));
-		}
+	if (fi->fib_rth_output) {
+		for (i = 0; i < nr_cpu_ids * RT_OUTPUT_SLOTS; i++)
+			rt_release_slot(&fi->fib_rth_output[i]);
+		kfree(fi->fib_rth_output);
+		fi->fib_rth_output = NULL;
 	}
 
-	/* Try to bind route to arp only if it is output
-	   route or unicast forwarding path.
-	 */
-	if (rt->rt_type == RTN_UNICAST || rt->fl.iif == 0) {
-		int err = arp_bind_neighbour(&rt->u.dst);
-		if (err) {
-			spin_unlock_bh(rt_hash_lock_addr(hash));
+	for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
+		struct fnhe_hash_bucket *hash = fi->fib_nh[nhsel].nh_exceptions;
 
-			if (err != -ENOBUFS) {
-				rt_drop(rt);
-				return err;
-			}
+		if (!hash)
+			continue;
+		for (i = 0; i < FNHE_HASH_SIZE; i++) {
+			struct fib_nh_exception *fnhe, *next;
 
-			/* Neighbour tables are full and nothing
-			   can be released. Try to shrink route cache,
-			   it is most likely it holds some neighbour records.
-			 */
-			if (attempts-- > 0) {
-				int saved_elasticity = ip_rt_gc_elasticity;
-				int saved_int = ip_rt_gc_min_interval;
-				ip_rt_gc_elasticity	= 1;
-				ip_rt_gc_min_interval	= 0;
-				rt_garbage_collect(&ipv4_dst_ops);
-				ip_rt_gc_min_interval	= saved_int;
-				ip_rt_gc_elasticity	= saved_elasticity;
-				goto restart;
+			for (fnhe = hash[i].chain; fnhe; fnhe = next) {
+				next = fnhe->fnhe_next;
+				kfree(fnhe);
 			}
-
-			if (net_ratelimit())
-				printk(KERN_WARNING "Neighbour table overflow.\n");
-			rt_drop(rt);
-			return -ENOBUFS;
 		}
+		kfree(hash);
+		fi->fib_nh[nhsel].nh_exceptions = NULL;
 	}
-
-	if (rthi)
-		rt->u.dst.rt_next = rthi->u.dst.rt_next;
-	else
-		rt->u.dst.rt_next = rt_hash_table[hash].chain;
-
-#if RT_CACHE_DEBUG >= 2
-	if (rt->u.dst.rt_next) {
-		struct rtable *trt;
-		printk(KERN_DEBUG "rt_cache @%02x: %pI4", hash, &rt->rt_dst);
-		for (trt = rt->u.dst.rt_next; trt; trt = trt->u.dst.rt_next)
-			printk(" . %pI4", &trt->rt_dst);
-		printk("\n");
-	}
-#endif
-	/*
-	 * Since lookup is lockfree, we must make sure
-	 * previous writes to rt are comitted to memory
-	 * before making rt visible to other CPUS.
-	 */
-	if (rthi)
-		rcu_assign_pointer(rthi->u.dst.rt_next, rt);
-	else
-		rcu_assign_pointer(rt_hash_table[hash].chain, rt);
-
-	spin_unlock_bh(rt_hash_lock_addr(hash));
-	*rp = rt;
-	return 0;
 }
 
 void rt_bind_peer(struct rtable *rt, int create)
@@ -1293,34 +1222,16 @@ void __ip_select_ident(struct iphdr *iph, struct dst_entry *dst, int more)
 	ip_select_fb_ident(iph);
 }
 
-static void rt_del(unsigned hash, struct rtable *rt)
-{
-	struct rtable **rthp, *aux;
-
-	rthp = &rt_hash_table[hash].chain;
-	spin_lock_bh(rt_hash_lock_addr(hash));
-	ip_rt_put(rt);
-	while ((aux = *rthp) != NULL) {
-		if (aux == rt || rt_is_expired(aux)) {
-			*rthp = aux->u.dst.rt_next;
-			rt_free(aux);
-			continue;
-		}
-		rthp = &aux->u.dst.rt_next;
-	}
-	spin_unlock_bh(rt_hash_lock_addr(hash));
-}
-
 void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 		    __be32 saddr, struct net_device *dev)
 {
-	int i, k;
 	struct in_device *in_dev = in_dev_get(dev);
-	struct rtable *rth, **rthp;
-	__be32  skeys[2] = { saddr, 0 };
-	int  ikeys[2] = { dev->ifindex, 0 };
 	struct netevent_redirect netevent;
+	struct rtable *rth, *rt;
+	struct fib_result res;
+	struct neighbour *n;
 	struct net *net;
+	int nhsel, found = 0;
 
 	if (!in_dev)
 		return;
@@ -1331,9 +1242,6 @@ void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 	    || ipv4_is_zeronet(new_gw))
 		goto reject_redirect;
 
-	if (!rt_caching(net))
-		goto reject_redirect;
-
 	if (!IN_DEV_SHARED_MEDIA(in_dev)) {
 		if (!inet_addr_onlink(in_dev, new_gw, old_gw))
 			goto reject_redirect;
@@ -1344,98 +1252,47 @@ void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 			goto reject_redirect;
 	}
 
-	for (i = 0; i < 2; i++) {
-		for (k = 0; k < 2; k++) {
-			unsigned hash = rt_hash(daddr, skeys[i], ikeys[k],
-						rt_genid(net));
-
-			rthp=&rt_hash_table[hash].chain;
-
-			rcu_read_lock();
-			while ((rth = rcu_dereference(*rthp)) != NULL) {
-				struct rtable *rt;
+	if (rt_output_fib_lookup(net, daddr, saddr, 0, 0, &res))
+		goto out;
 
-				if (rth->fl.fl4_dst != daddr ||
-				    rth->fl.fl4_src != skeys[i] ||
-				    rth->fl.oif != ikeys[k] ||
-				    rth->fl.iif != 0 ||
-				    rt_is_expired(rth) ||
-				    !net_eq(dev_net(rth->u.dst.dev), net)) {
-					rthp = &rth->u.dst.rt_next;
+	n = __neigh_lookup(&arp_tbl, &new_gw, dev, 1);
+	if (n) {
+		if (!(n->nud_state & NUD_VALID)) {
+			/* Not usable yet, the next redirect will be. */
+			neigh_event_send(n, NULL);
+		} else {
+			for (nhsel = 0; nhsel < res.fi->fib_nhs; nhsel++) {
+				struct fib_nh *nh = &res.fi->fib_nh[nhsel];
+
+				if (nh->nh_dev != dev ||
+				    rt_nh_gateway(nh, daddr) != old_gw)
 					continue;
-				}
-
-				if (rth->rt_dst != daddr ||
-				    rth->rt_src != saddr ||
-				    rth->u.dst.error ||
-				    rth->rt_gateway != old_gw ||
-				    rth->u.dst.dev != dev)
-					break;
-
-				dst_hold(&rth->u.dst);
-				rcu_read_unlock();
-
-				rt = dst_alloc(&ipv4_dst_ops);
-				if (rt == NULL) {
-					ip_rt_put(rth);
-					in_dev_put(in_dev);
-					return;
-				}
+				update_or_create_fnhe(nh, daddr, new_gw, 0, 0, 0);
+				found = 1;
+			}
+		}
+		neigh_release(n);
+	}
 
-				/* Copy all the information. */
-				*rt = *rth;
-				rt->u.dst.__use		= 1;
-				atomic_set(&rt->u.dst.__refcnt, 1);
-				rt->u.dst.child		= NULL;
-				if (rt->u.dst.dev)
-					dev_hold(rt->u.dst.dev);
-				if (rt->idev)
-					in_dev_hold(rt->idev);
-				rt->u.dst.obsolete	= 0;
-				rt->u.dst.lastuse	= jiffies;
-				rt->u.dst.path		= &rt->u.dst;
-				rt->u.dst.neighbour	= NULL;
-				rt->u.dst.hh		= NULL;
-#ifdef CONFIG_XFRM
-				rt->u.dst.xfrm		= NULL;
-#endif
-				rt->rt_genid		= rt_genid(net);
-				rt->rt_flags		|= RTCF_REDIRECTED;
-
-				/* Gateway is different ... */
-				rt->rt_gateway		= new_gw;
-
-				/* Redirect received -> path was valid */
-				dst_confirm(&rth->u.dst);
-
-				if (rt->peer)
-					atomic_inc(&rt->peer->refcnt);
-
-				if (arp_bind_neighbour(&rt->u.dst) ||
-				    !(rt->u.dst.neighbour->nud_state &
-					    NUD_VALID)) {
-					if (rt->u.dst.neighbour)
-						neigh_event_send(rt->u.dst.neighbour, NULL);
-					ip_rt_put(rth);
-					rt_drop(rt);
-					goto do_next;
-				}
+	if (found) {
+		rth = rt_cached_output(res.fi, daddr);
+		rt_invalidate_dst(res.fi, daddr);
+		if (rth) {
+			/* Redirect received -> path was valid */
+			dst_confirm(&rth->u.dst);
 
+			if (!__ip_route_output_key(net, &rt, &rth->fl)) {
 				netevent.old = &rth->u.dst;
 				netevent.new = &rt->u.dst;
 				call_netevent_notifiers(NETEVENT_REDIRECT,
 							&netevent);
-
-				rt_del(hash, rth);
-				if (!rt_intern_hash(hash, rt, &rt))
-					ip_rt_put(rt);
-				goto do_next;
+				ip_rt_put(rt);
 			}
-			rcu_read_unlock();
-		do_next:
-			;
+			ip_rt_put(rth);
 		}
 	}
+	fib_res_put(&res);
+out:
 	in_dev_put(in_dev);
 	return;
 
@@ -1456,19 +1313,17 @@ static struct dst_entry *ipv4_negative_advice(struct dst_entry *dst)
 	struct dst_entry *ret = dst;
 
 	if (rt) {
-		if (dst->obsolete) {
+		if (dst->obsolete > 0) {
 			ip_rt_put(rt);
 			ret = NULL;
 		} else if ((rt->rt_flags & RTCF_REDIRECTED) ||
 			   rt->u.dst.expires) {
-			unsigned hash = rt_hash(rt->fl.fl4_dst, rt->fl.fl4_src,
-						rt->fl.oif,
-						rt_genid(dev_net(dst->dev)));
 #if RT_CACHE_DEBUG >= 1
 			printk(KERN_DEBUG "ipv4_negative_advice: redirect to %pI4/%02x dropped\n",
 				&rt->rt_dst, rt->fl.fl4_tos);
 #endif
-			rt_del(hash, rt);
+			rt_forget_exceptions(rt);
+			ip_rt_put(rt);
 			ret = NULL;
 		}
 	}
@@ -1598,86 +1453,91 @@ unsigned short ip_rt_frag_needed(struct net *net, struct iphdr *iph,
 				 unsigned short new_mtu,
 				 struct net_device *dev)
 {
-	int i, k;
 	unsigned short old_mtu = ntohs(iph->tot_len);
-	struct rtable *rth;
-	int  ikeys[2] = { dev->ifindex, 0 };
-	__be32  skeys[2] = { iph->saddr, 0, };
-	__be32  daddr = iph->daddr;
-	unsigned short est_mtu = 0;
+	unsigned short mtu = new_mtu;
+	unsigned int path_mtu;
+	struct fib_result res;
+	int locked = 0;
 
 	if (ipv4_config.no_pmtu_disc)
 		return 0;
 
-	for (k = 0; k < 2; k++) {
-		for (i = 0; i < 2; i++) {
-			unsigned hash = rt_hash(daddr, skeys[i], ikeys[k],
-						rt_genid(net));
-
-			rcu_read_lock();
-			for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
-			     rth = rcu_dereference(rth->u.dst.rt_next)) {
-				unsigned short mtu = new_mtu;
-
-				if (rth->fl.fl4_dst != daddr ||
-				    rth->fl.fl4_src != skeys[i] ||
-				    rth->rt_dst != daddr ||
-				    rth->rt_src != iph->saddr ||
-				    rth->fl.oif != ikeys[k] ||
-				    rth->fl.iif != 0 ||
-				    dst_metric_locked(&rth->u.dst, RTAX_MTU) ||
-				    !net_eq(dev_net(rth->u.dst.dev), net) ||
-				    rt_is_expired(rth))
-					continue;
+	if (rt_output_fib_lookup(net, iph->daddr, iph->saddr, iph->tos, 0,
+				 &res))
+		return new_mtu;
 
-				if (new_mtu < 68 || new_mtu >= old_mtu) {
+	if (res.fi->fib_metrics[RTAX_LOCK-1] & (1 << RTAX_MTU)) {
+		fib_res_put(&res);
+		return new_mtu;
+	}
+	path_mtu = rt_fib_mtu(&res, iph->daddr);
 
-					/* BSD 4.2 compatibility hack :-( */
-					if (mtu == 0 &&
-					    old_mtu >= dst_mtu(&rth->u.dst) &&
-					    old_mtu >= 68 + (iph->ihl << 2))
-						old_mtu -= iph->ihl << 2;
+	if (new_mtu < 68 || new_mtu >= old_mtu) {
 
-					mtu = guess_mtu(old_mtu);
-				}
-				if (mtu <= dst_mtu(&rth->u.dst)) {
-					if (mtu < dst_mtu(&rth->u.dst)) {
-						dst_confirm(&rth->u.dst);
-						if (mtu < ip_rt_min_pmtu) {
-							mtu = ip_rt_min_pmtu;
-							rth->u.dst.metrics[RTAX_LOCK-1] |=
-								(1 << RTAX_MTU);
-						}
-						rth->u.dst.metrics[RTAX_MTU-1] = mtu;
-						dst_set_expires(&rth->u.dst,
-							ip_rt_mtu_expires);
-					}
-					est_mtu = mtu;
-				}
-			}
-			rcu_read_unlock();
+		/* BSD 4.2 compatibility hack :-( */
+		if (mtu == 0 &&
+		    old_mtu >= path_mtu &&
+		    old_mtu >= 68 + (iph->ihl << 2))
+			old_mtu -= iph->ihl << 2;
+
+		mtu = guess_mtu(old_mtu);
+	}
+	if (mtu > path_mtu) {
+		fib_res_put(&res);
+		return new_mtu;
+	}
+	if (mtu < path_mtu) {
+		if (mtu < ip_rt_min_pmtu) {
+			mtu = ip_rt_min_pmtu;
+			locked = 1;
 		}
+		rt_learn_pmtu(res.fi, iph->daddr, mtu, locked);
 	}
-	return est_mtu ? : new_mtu;
+	fib_res_put(&res);
+	return mtu;
 }
 
 static void ip_rt_update_pmtu(struct dst_entry *dst, u32 mtu)
 {
+	struct rtable *rt = (struct rtable *)dst;
+
 	if (dst_mtu(dst) > mtu && mtu >= 68 &&
 	    !(dst_metric_locked(dst, RTAX_MTU))) {
+		struct fib_result res;
+		int locked = 0;
+
 		if (mtu < ip_rt_min_pmtu) {
 			mtu = ip_rt_min_pmtu;
 			dst->metrics[RTAX_LOCK-1] |= (1 << RTAX_MTU);
+			locked = 1;
 		}
 		dst->metrics[RTAX_MTU-1] = mtu;
 		dst_set_expires(dst, ip_rt_mtu_expires);
+
+		/* Let the other routes to this destination know too. */
+		if (!rt->fl.iif &&
+		    !rt_output_fib_lookup(dev_net(dst->dev), rt->rt_dst,
+					  rt->rt_src, rt->fl.fl4_tos,
+					  rt->fl.mark, &res)) {
+			rt_learn_pmtu(res.fi, rt->rt_dst, mtu, locked);
+			fib_res_put(&res);
+		}
 		call_netevent_notifiers(NETEVENT_PMTU_UPDATE, dst);
 	}
 }
 
+/*
+ * ipv4 routes are born with obsolete == -1, so that their users come
+ * here on every use: a route stays good until it is freed, its generation
+ * is flushed or the PMTU learnt on it runs out.
+ */
 static struct dst_entry *ipv4_dst_check(struct dst_entry *dst, u32 cookie)
 {
-	return NULL;
+	struct rtable *rt = (struct rtable *)dst;
+
+	if (dst->obsolete > 0 || rt_is_expired(rt) || rt_dst_expired(rt))
+		return NULL;
+	return dst;
 }
 
 static void ipv4_dst_destroy(struct dst_entry *dst)
@@ -1812,7 +1672,6 @@ static void rt_set_nexthop(struct rtable *rt, struct fib_result *res, u32 itag)
 static int ip_route_input_mc(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 				u8 tos, struct net_device *dev, int our)
 {
-	unsigned hash;
 	struct rtable *rth;
 	__be32 spec_dst;
 	struct in_device *in_dev = in_dev_get(dev);
@@ -1842,6 +1701,7 @@ static int ip_route_input_mc(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	rth->u.dst.output= ip_rt_bug;
 
 	atomic_set(&rth->u.dst.__refcnt, 1);
+	rth->u.dst.obsolete = -1;
 	rth->u.dst.flags= DST_HOST;
 	if (IN_DEV_CONF_GET(in_dev, NOPOLICY))
 		rth->u.dst.flags |= DST_NOPOLICY;
@@ -1877,8 +1737,7 @@ static int ip_route_input_mc(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	RT_CACHE_STAT_INC(in_slow_mc);
 
 	in_dev_put(in_dev);
-	hash = rt_hash(daddr, saddr, dev->ifindex, rt_genid(dev_net(dev)));
-	return rt_intern_hash(hash, rth, &skb->rtable);
+	return rt_finish(rth, NULL, &skb->rtable);
 
 e_nobufs:
 	in_dev_put(in_dev);
@@ -1980,6 +1839,7 @@ static int __mkroute_input(struct sk_buff *skb,
 	}
 
 	atomic_set(&rth->u.dst.__refcnt, 1);
+	rth->u.dst.obsolete = -1;
 	rth->u.dst.flags= DST_HOST;
 	if (IN_DEV_CONF_GET(in_dev, NOPOLICY))
 		rth->u.dst.flags |= DST_NOPOLICY;
@@ -2016,15 +1876,50 @@ static int __mkroute_input(struct sk_buff *skb,
 	return err;
 }
 
+/*
+ * Look for a cached input route for @fl on @res->fi.  On a miss, *slotp
+ * is where the route about to be built should go, or NULL if it can't
+ * be cached.
+ */
+static struct rtable *rt_input_cache_get(struct fib_result *res,
+					 struct flowi *fl, struct net *net,
+					 struct rtable ***slotp)
+{
+	struct rtable **slot = NULL;
+	struct rtable *rth = NULL;
+
+	if (res->fi) {
+		struct rtable **bucket;
+
+		rcu_read_lock_bh();
+		bucket = rt_input_bucket(res->fi, fl->fl4_dst, fl->fl4_src,
+					 fl->iif);
+		if (bucket)
+			rth = rt_input_lookup(bucket, fl, net, &slot);
+		rcu_read_unlock_bh();
+	}
+	*slotp = slot;
+	return rth;
+}
+
 static int ip_mkroute_input(struct sk_buff *skb,
 			    struct fib_result *res,
-			    const struct flowi *fl,
+			    struct flowi *fl,
 			    struct in_device *in_dev,
 			    __be32 daddr, __be32 saddr, u32 tos)
 {
 	struct rtable* rth = NULL;
+	struct rtable **slot;
 	int err;
-	unsigned hash;
+
+	/* The cache is looked at before a multipath nexthop is chosen,
+	 * so that a flow keeps to the one it got first.
+	 */
+	rth = rt_input_cache_get(res, fl, dev_net(in_dev->dev), &slot);
+	if (rth) {
+		skb->rtable = rth;
+		return 0;
+	}
 
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 	if (res->fi && res->fi->fib_nhs > 1 && fl->oif == 0)
@@ -2036,10 +1931,7 @@ static int ip_mkroute_input(struct sk_buff *skb,
 	if (err)
 		return err;
 
-	/* put it into the cache */
-	hash = rt_hash(daddr, saddr, fl->iif,
-		       rt_genid(dev_net(rth->u.dst.dev)));
-	return rt_intern_hash(hash, rth, &skb->rtable);
+	return rt_finish(rth, slot, &skb->rtable);
 }
 
 /*
@@ -2068,12 +1960,14 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	unsigned	flags = 0;
 	u32		itag = 0;
 	struct rtable * rth;
-	unsigned	hash;
+	struct rtable **slot = NULL;
 	__be32		spec_dst;
 	int		err = -EINVAL;
 	int		free_res = 0;
 	struct net    * net = dev_net(dev);
 
+	res.fi = NULL;
+
 	/* IP on this device is disabled. */
 
 	if (!in_dev)
@@ -2117,6 +2011,10 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 
 	if (res.type == RTN_LOCAL) {
 		int result;
+
+		rth = rt_input_cache_get(&res, &fl, net, &slot);
+		if (rth)
+			goto cached;
 		result = fib_validate_source(saddr, daddr, tos,
 					     net->loopback_dev->ifindex,
 					     dev, &spec_dst, &itag);
@@ -2144,6 +2042,10 @@ brd_input:
 	if (skb->protocol != htons(ETH_P_IP))
 		goto e_inval;
 
+	rth = rt_input_cache_get(&res, &fl, net, &slot);
+	if (rth)
+		goto cached;
+
 	if (ipv4_is_zeronet(saddr))
 		spec_dst = inet_select_addr(dev, 0, RT_SCOPE_LINK);
 	else {
@@ -2167,6 +2069,7 @@ local_input:
 	rth->rt_genid = rt_genid(net);
 
 	atomic_set(&rth->u.dst.__refcnt, 1);
+	rth->u.dst.obsolete = -1;
 	rth->u.dst.flags= DST_HOST;
 	if (IN_DEV_CONF_GET(in_dev, NOPOLICY))
 		rth->u.dst.flags |= DST_NOPOLICY;
@@ -2194,8 +2097,12 @@ local_input:
 		rth->rt_flags 	&= ~RTCF_LOCAL;
 	}
 	rth->rt_type	= res.type;
-	hash = rt_hash(daddr, saddr, fl.iif, rt_genid(net));
-	err = rt_intern_hash(hash, rth, &skb->rtable);
+	err = rt_finish(rth, slot, &skb->rtable);
+	goto done;
+
+cached:
+	skb->rtable = rth;
+	err = 0;
 	goto done;
 
 no_route:
@@ -2237,41 +2144,8 @@ martian_source:
 int ip_route_input(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 		   u8 tos, struct net_device *dev)
 {
-	struct rtable * rth;
-	unsigned	hash;
-	int iif = dev->ifindex;
-	struct net *net;
-
-	net = dev_net(dev);
-
-	if (!rt_caching(net))
-		goto skip_cache;
-
 	tos &= IPTOS_RT_MASK;
-	hash = rt_hash(daddr, saddr, iif, rt_genid(net));
-
-	rcu_read_lock();
-	for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
-	     rth = rcu_dereference(rth->u.dst.rt_next)) {
-		if (((rth->fl.fl4_dst ^ daddr) |
-		     (rth->fl.fl4_src ^ saddr) |
-		     (rth->fl.iif ^ iif) |
-		     rth->fl.oif |
-		     (rth->fl.fl4_tos ^ tos)) == 0 &&
-		    rth->fl.mark == skb->mark &&
-		    net_eq(dev_net(rth->u.dst.dev), net) &&
-		    !rt_is_expired(rth)) {
-			dst_use(&rth->u.dst, jiffies);
-			RT_CACHE_STAT_INC(in_hit);
-			rcu_read_unlock();
-			skb->rtable = rth;
-			return 0;
-		}
-		RT_CACHE_STAT_INC(in_hlist_search);
-	}
-	rcu_read_unlock();
 
-skip_cache:
 	/* Multicast recognition logic is moved from route cache to here.
 	   The problem was that too many Ethernet cards have broken/missing
 	   hardware multicast filters :-( As result the host on multicasting
@@ -2315,6 +2189,7 @@ static int __mkroute_output(struct rtable **result,
 			    unsigned flags)
 {
 	struct rtable *rth;
+	struct rtable **slot = NULL;
 	struct in_device *in_dev;
 	u32 tos = RT_FL_TOS(oldflp);
 	int err = 0;
@@ -2358,6 +2233,17 @@ static int __mkroute_output(struct rtable **result,
 		}
 	}
 
+	rcu_read_lock_bh();
+	if (res->fi) {
+		slot = rt_output_slot(res->fi, oldflp->fl4_dst);
+		if (slot) {
+			rth = rt_output_lookup(slot, oldflp, dev_net(dev_out));
+			if (rth) {
+				*result = rth;
+				goto cleanup;
+			}
+		}
+	}
 
 	rth = dst_alloc(&ipv4_dst_ops);
 	if (!rth) {
@@ -2366,6 +2252,7 @@ static int __mkroute_output(struct rtable **result,
 	}
 
 	atomic_set(&rth->u.dst.__refcnt, 1);
+	rth->u.dst.obsolete = -1;
 	rth->u.dst.flags= DST_HOST;
 	if (IN_DEV_CONF_GET(in_dev, NOXFRM))
 		rth->u.dst.flags |= DST_NOXFRM;
@@ -2419,33 +2306,23 @@ static int __mkroute_output(struct rtable **result,
 
 	rth->rt_flags = flags;
 
-	*result = rth;
+	if (res->fi) {
+		struct fib_nh_exception *fnhe;
+
+		fnhe = find_exception(&FIB_RES_NH(*res), fl->fl4_dst);
+		if (fnhe)
+			rt_bind_exception(rth, fnhe, fl->fl4_dst);
+	}
+
+	err = rt_finish(rth, slot, result);
  cleanup:
+	rcu_read_unlock_bh();
 	/* release work reference to inet device */
 	in_dev_put(in_dev);
 
 	return err;
 }
 
-static int ip_mkroute_output(struct rtable **rp,
-			     struct fib_result *res,
-			     const struct flowi *fl,
-			     const struct flowi *oldflp,
-			     struct net_device *dev_out,
-			     unsigned flags)
-{
-	struct rtable *rth = NULL;
-	int err = __mkroute_output(&rth, res, fl, oldflp, dev_out, flags);
-	unsigned hash;
-	if (err == 0) {
-		hash = rt_hash(oldflp->fl4_dst, oldflp->fl4_src, oldflp->oif,
-			       rt_genid(dev_net(dev_out)));
-		err = rt_intern_hash(hash, rth, rp);
-	}
-
-	return err;
-}
-
 /*
  * Major route resolver routine.
  */
@@ -2615,9 +2492,6 @@ static int ip_route_output_slow(struct net *net, struct rtable **rp,
 		dev_out = net->loopback_dev;
 		dev_hold(dev_out);
 		fl.oif = dev_out->ifindex;
-		if (res.fi)
-			fib_info_put(res.fi);
-		res.fi = NULL;
 		flags |= RTCF_LOCAL;
 		goto make_route;
 	}
@@ -2641,7 +2515,7 @@ static int ip_route_output_slow(struct net *net, struct rtable **rp,
 
 
 make_route:
-	err = ip_mkroute_output(rp, &res, &fl, oldflp, dev_out, flags);
+	err = __mkroute_output(rp, &res, &fl, oldflp, dev_out, flags);
 
 
 	if (free_res)
@@ -2654,37 +2528,6 @@ out:	return err;
 int __ip_route_output_key(struct net *net, struct rtable **rp,
 			  const struct flowi *flp)
 {
-	unsigned hash;
-	struct rtable *rth;
-
-	if (!rt_caching(net))
-		goto slow_output;
-
-	hash = rt_hash(flp->fl4_dst, flp->fl4_src, flp->oif, rt_genid(net));
-
-	rcu_read_lock_bh();
-	for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
-		rth = rcu_dereference(rth->u.dst.rt_next)) {
-		if (rth->fl.fl4_dst == flp->fl4_dst &&
-		    rth->fl.fl4_src == flp->fl4_src &&
-		    rth->fl.iif == 0 &&
-		    rth->fl.oif == flp->oif &&
-		    rth->fl.mark == flp->mark &&
-		    !((rth->fl.fl4_tos ^ flp->fl4_tos) &
-			    (IPTOS_RT_MASK | RTO_ONLINK)) &&
-		    net_eq(dev_net(rth->u.dst.dev), net) &&
-		    !rt_is_expired(rth)) {
-			dst_use(&rth->u.dst, jiffies);
-			RT_CACHE_STAT_INC(out_hit);
-			rcu_read_unlock_bh();
-			*rp = rth;
-			return 0;
-		}
-		RT_CACHE_STAT_INC(out_hlist_search);
-	}
-	rcu_read_unlock_bh();
-
-slow_output:
 	return ip_route_output_slow(net, rp, flp);
 }
 
@@ -2964,45 +2807,12 @@ errout_free:
 	goto errout;
 }
 
+/*
+ * There is no flow cache to walk any more, so a dump of cloned routes
+ * (RTM_F_CLONED) comes back empty.
+ */
 int ip_rt_dump(struct sk_buff *skb,  struct netlink_callback *cb)
 {
-	struct rtable *rt;
-	int h, s_h;
-	int idx, s_idx;
-	struct net *net;
-
-	net = sock_net(skb->sk);
-
-	s_h = cb->args[0];
-	if (s_h < 0)
-		s_h = 0;
-	s_idx = idx = cb->args[1];
-	for (h = s_h; h <= rt_hash_mask; h++, s_idx = 0) {
-		if (!rt_hash_table[h].chain)
-			continue;
-		rcu_read_lock_bh();
-		for (rt = rcu_dereference(rt_hash_table[h].chain), idx = 0; rt;
-		     rt = rcu_dereference(rt->u.dst.rt_next), idx++) {
-			if (!net_eq(dev_net(rt->u.dst.dev), net) || idx < s_idx)
-				continue;
-			if (rt_is_expired(rt))
-				continue;
-			skb->dst = dst_clone(&rt->u.dst);
-			if (rt_fill_info(skb, NETLINK_CB(cb->skb).pid,
-					 cb->nlh->nlmsg_seq, RTM_NEWROUTE,
-					 1, NLM_F_MULTI) <= 0) {
-				dst_release(xchg(&skb->dst, NULL));
-				rcu_read_unlock_bh();
-				goto done;
-			}
-			dst_release(xchg(&skb->dst, NULL));
-		}
-		rcu_read_unlock_bh();
-	}
-
-done:
-	cb->args[0] = h;
-	cb->args[1] = idx;
 	return skb->len;
 }
 
@@ -3050,65 +2860,6 @@ static int ipv4_sysctl_rtcache_flush_strategy(ctl_table *table,
 	return 0;
 }
 
-static void rt_secret_reschedule(int old)
-{
-	struct net *net;
-	int new = ip_rt_secret_interval;
-	int diff = new - old;
-
-	if (!diff)
-		return;
-
-	rtnl_lock();
-	for_each_net(net) {
-		int deleted = del_timer_sync(&net->ipv4.rt_secret_timer);
-
-		if (!new)
-			continue;
-
-		if (deleted) {
-			long time = net->ipv4.rt_secret_timer.expires - jiffies;
-
-			if (time <= 0 || (time += diff) <= 0)
-				time = 0;
-
-			net->ipv4.rt_secret_timer.expires = time;
-		} else
-			net->ipv4.rt_secret_timer.expires = new;
-
-		net->ipv4.rt_secret_timer.expires += jiffies;
-		add_timer(&net->ipv4.rt_secret_timer);
-	}
-	rtnl_unlock();
-}
-
-static int ipv4_sysctl_rt_secret_interval(ctl_table *ctl, int write,
-					  struct file *filp,
-					  void __user *buffer, size_t *lenp,
-					  loff_t *ppos)
-{
-	int old = ip_rt_secret_interval;
-	int ret = proc_dointvec_jiffies(ctl, write, filp, buffer, lenp, ppos);
-
-	rt_secret_reschedule(old);
-
-	return ret;
-}
-
-static int ipv4_sysctl_rt_secret_interval_strategy(ctl_table *table,
-						   void __user *oldval,
-						   size_t __user *oldlenp,
-						   void __user *newval,
-						   size_t newlen)
-{
-	int old = ip_rt_secret_interval;
-	int ret = sysctl_jiffies(table, oldval, oldlenp, newval, newlen);
-
-	rt_secret_reschedule(old);
-
-	return ret;
-}
-
 static ctl_table ipv4_route_table[] = {
 	{
 		.ctl_name	= NET_IPV4_ROUTE_GC_THRESH,
@@ -3243,8 +2994,8 @@ static ctl_table ipv4_route_table[] = {
 		.data		= &ip_rt_secret_interval,
 		.maxlen		= sizeof(int),
 		.mode		= 0644,
-		.proc_handler	= ipv4_sysctl_rt_secret_interval,
-		.strategy	= ipv4_sysctl_rt_secret_interval_strategy,
+		.proc_handler	= proc_dointvec_jiffies,
+		.strategy	= sysctl_jiffies,
 	},
 	{ .ctl_name = 0 }
 };
@@ -3327,33 +3078,16 @@ static __net_initdata struct pernet_operations sysctl_route_ops = {
 #endif
 
 
-static __net_init int rt_secret_timer_init(struct net *net)
+static __net_init int rt_genid_init(struct net *net)
 {
 	atomic_set(&net->ipv4.rt_genid,
 			(int) ((num_physpages ^ (num_physpages>>8)) ^
 			(jiffies ^ (jiffies >> 7))));
-
-	net->ipv4.rt_secret_timer.function = rt_secret_rebuild;
-	net->ipv4.rt_secret_timer.data = (unsigned long)net;
-	init_timer_deferrable(&net->ipv4.rt_secret_timer);
-
-	if (ip_rt_secret_interval) {
-		net->ipv4.rt_secret_timer.expires =
-			jiffies + net_random() % ip_rt_secret_interval +
-			ip_rt_secret_interval;
-		add_timer(&net->ipv4.rt_secret_timer);
-	}
 	return 0;
 }
 
-static __net_exit void rt_secret_timer_exit(struct net *net)
-{
-	del_timer_sync(&net->ipv4.rt_secret_timer);
-}
-
-static __net_initdata struct pernet_operations rt_secret_timer_ops = {
-	.init = rt_secret_timer_init,
-	.exit = rt_secret_timer_exit,
+static __net_initdata struct pernet_operations rt_genid_ops = {
+	.init = rt_genid_init,
 };
 
 
@@ -3361,19 +3095,10 @@ static __net_initdata struct pernet_operations rt_secret_timer_ops = {
 struct ip_rt_acct *ip_rt_acct __read_mostly;
 #endif /* CONFIG_NET_CLS_ROUTE */
 
-static __initdata unsigned long rhash_entries;
-static int __init set_rhash_entries(char *str)
-{
-	if (!str)
-		return 0;
-	rhash_entries = simple_strtoul(str, &str, 0);
-	return 1;
-}
-__setup("rhash_entries=", set_rhash_entries);
-
 int __init ip_rt_init(void)
 {
 	int rc = 0;
+	int cpu;
 
 #ifdef CONFIG_NET_CLS_ROUTE
 	ip_rt_acct = __alloc_percpu(256 * sizeof(struct ip_rt_acct));
@@ -3387,33 +3112,16 @@ int __init ip_rt_init(void)
 
 	ipv4_dst_blackhole_ops.kmem_cachep = ipv4_dst_ops.kmem_cachep;
 
-	rt_hash_table = (struct rt_hash_bucket *)
-		alloc_large_system_hash("IP route cache",
-					sizeof(struct rt_hash_bucket),
-					rhash_entries,
-					(num_physpages >= 128 * 1024) ?
-					15 : 17,
-					0,
-					&rt_hash_log,
-					&rt_hash_mask,
-					0);
-	memset(rt_hash_table, 0, (rt_hash_mask + 1) * sizeof(struct rt_hash_bucket));
-	rt_hash_lock_init();
-
-	ipv4_dst_ops.gc_thresh = (rt_hash_mask + 1);
-	ip_rt_max_size = (rt_hash_mask + 1) * 16;
+	get_random_bytes(&rt_cache_rnd, sizeof(rt_cache_rnd));
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(rt_uncached_list, cpu).lock);
 
 	devinet_init();
 	ip_fib_init();
 
-	/* All the timers, started at system startup tend
-	   to synchronize. Perturb it a bit.
-	 */
-	schedule_delayed_work(&expires_work,
-		net_random() % ip_rt_gc_interval + ip_rt_gc_interval);
-
-	if (register_pernet_subsys(&rt_secret_timer_ops))
-		printk(KERN_ERR "Unable to setup rt_secret_timer\n");
+	if (register_pernet_subsys(&rt_genid_ops))
+		printk(KERN_ERR "Unable to setup rt_genid\n");
 
 	if (ip_rt_proc_init())
 		printk(KERN_ERR "Unable to create route proc files\n");
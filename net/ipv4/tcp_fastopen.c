@@ -0,0 +1,115 @@
+/*
+ * TCP Fast Open: cookie generation and the client side cookie cache.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+/* As with syncookie_secret, the tail seeds the digest words of the hash */
+static __u32 tcp_fastopen_secret[16 - 1 + SHA_DIGEST_WORDS] __read_mostly;
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+static DEFINE_PER_CPU(__u32, tcp_fastopen_scratch)[16 + 5 + SHA_WORKSPACE_WORDS];
+
+/*
+ * The cookie is a MAC of the client address under a boot time secret, so
+ * the server keeps no per client state: a SYN carrying the right cookie
+ * proves the sender has received a SYN-ACK at that address before.
+ */
+void tcp_fastopen_cookie_gen(__be32 addr, struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp;
+
+	local_bh_disable();
+	tmp = __get_cpu_var(tcp_fastopen_scratch);
+	tmp[0] = (__force u32)addr;
+	memcpy(tmp + 1, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	local_bh_enable();
+
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+/*
+ * Client side: cookies handed out by servers are kept in the inet_peer
+ * entry of the destination, so they outlive the connection that got them.
+ */
+static DEFINE_SPINLOCK(tcp_fastopen_lock);
+
+void tcp_fastopen_cache_get(struct sock *sk, struct tcp_fastopen_cookie *cookie)
+{
+	struct inet_peer *peer = inet_getpeer(inet_sk(sk)->daddr, 0);
+
+	cookie->len = 0;
+	if (peer == NULL)
+		return;
+
+	spin_lock_bh(&tcp_fastopen_lock);
+	if (peer->tcp_fastopen_cookie_len) {
+		cookie->len = peer->tcp_fastopen_cookie_len;
+		memcpy(cookie->val, peer->tcp_fastopen_cookie, cookie->len);
+	}
+	spin_unlock_bh(&tcp_fastopen_lock);
+
+	inet_putpeer(peer);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, struct tcp_fastopen_cookie *cookie)
+{
+	struct inet_peer *peer;
+
+	if (cookie->len < TCP_FASTOPEN_COOKIE_MIN ||
+	    cookie->len > TCP_FASTOPEN_COOKIE_MAX)
+		return;
+
+	peer = inet_getpeer(inet_sk(sk)->daddr, 1);
+	if (peer == NULL)
+		return;
+
+	spin_lock_bh(&tcp_fastopen_lock);
+	peer->tcp_fastopen_cookie_len = cookie->len;
+	memcpy(peer->tcp_fastopen_cookie, cookie->val, cookie->len);
+	spin_unlock_bh(&tcp_fastopen_lock);
+
+	inet_putpeer(peer);
+}
+
+/*
+ * Server side: the SYN-ACK of a child created from a Fast Open SYN has
+ * been acknowledged.  Drop the request sock that was kept around for SYN-ACK
+ * retransmission and hand the retransmit timer back to the data path.
+ */
+void tcp_fastopen_synack_acked(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct inet_connection_sock *icsk = inet_csk(sk);
+
+	tcp_free_fastopen_rsk(tp);
+	icsk->icsk_retransmits = 0;
+
+	if (tp->packets_out)
+		inet_csk_reset_xmit_timer(sk, ICSK_TIME_RETRANS,
+					  icsk->icsk_rto, TCP_RTO_MAX);
+	else
+		inet_csk_clear_xmit_timer(sk, ICSK_TIME_RETRANS);
+}
@@ -3053,6 +3053,32 @@ static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
 	tcp_xmit_retransmit_queue(sk);
 }
 
+/* Set the sk_pacing_rate to allow proper sizing of TSO packets and
+ * pacing by the packet scheduler: twice cwnd worth of bytes per srtt,
+ * so slow start can still double the window every round trip.
+ */
+static void tcp_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	u64 rate;
+
+	/* set sk_pacing_rate to 200 % of current rate (mss * cwnd / srtt) */
+	rate = (u64)tp->mss_cache * 2 * (HZ << 3);
+
+	rate *= max(tp->snd_cwnd, tp->packets_out);
+
+	/* Correction for small srtt : minimum srtt being 8 (1 jiffy << 3),
+	 * be conservative and assume srtt = 1 (125 us instead of 1.25 ms)
+	 * We probably need usec resolution in the future.
+	 * Note: This also takes care of possible srtt=0 case,
+	 * when tcp_rtt_estimator() was not yet called.
+	 */
+	if (tp->srtt > 8 + 2)
+		do_div(rate, tp->srtt);
+
+	sk->sk_pacing_rate = min_t(u64, rate, ~0U);
+}
+
 static void tcp_valid_rtt_meas(struct sock *sk, u32 seq_rtt)
 {
 	tcp_rtt_estimator(sk, seq_rtt);
@@ -3655,6 +3681,7 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 		if ((flag & FLAG_DATA_ACKED) && !frto_cwnd)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
+	tcp_update_pacing_rate(sk);
 
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(sk->sk_dst_cache);
@@ -3687,7 +3714,7 @@ uninteresting_ack:
  * the fast version below fails.
  */
 void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
-		       int estab)
+		       int estab, struct tcp_fastopen_cookie *foc)
 {
 	unsigned char *ptr;
 	struct tcphdr *th = tcp_hdr(skb);
@@ -3771,6 +3798,20 @@ void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
 				 */
 				break;
 #endif
+			case TCPOPT_FASTOPEN:
+				/* Only the SYN and SYN-ACK carry a cookie, an
+				 * empty option is a cookie request.
+				 */
+				if (foc && th->syn && !estab &&
+				    (opsize == TCPOLEN_FASTOPEN_BASE ||
+				     (opsize >= TCPOLEN_FASTOPEN_BASE +
+						TCP_FASTOPEN_COOKIE_MIN &&
+				      opsize <= TCPOLEN_FASTOPEN_BASE +
+						TCP_FASTOPEN_COOKIE_MAX))) {
+					foc->len = opsize - TCPOLEN_FASTOPEN_BASE;
+					memcpy(foc->val, ptr, foc->len);
+				}
+				break;
 			}
 
 			ptr += opsize-2;
@@ -3809,7 +3850,7 @@ static int tcp_fast_parse_options(struct sk_buff *skb, struct tcphdr *th,
 		if (tcp_parse_aligned_timestamp(tp, th))
 			return 1;
 	}
-	tcp_parse_options(skb, &tp->rx_opt, 1);
+	tcp_parse_options(skb, &tp->rx_opt, 1, NULL);
 	return 1;
 }
 
@@ -5333,14 +5374,48 @@ discard:
 	return 0;
 }
 
+/* The SYN-ACK of an active Fast Open arrived.  Remember the cookie the
+ * server handed out and, if the server did not take the data we sent
+ * along with the SYN, retransmit it right away.  Returns non-zero when a
+ * segment carrying the ACK of the SYN-ACK was sent.
+ */
+static int tcp_rcv_fastopen_synack(struct sock *sk, struct sk_buff *synack,
+				   struct tcp_fastopen_cookie *cookie)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *data = tp->syn_data ? tcp_write_queue_head(sk) : NULL;
+
+	if (cookie->len > 0)
+		tcp_fastopen_cache_set(sk, cookie);
+
+	tp->syn_fastopen = 0;
+	tp->syn_data = 0;
+
+	if (data == NULL || data == tcp_send_head(sk))
+		return 0;
+
+	/* The server only acked our SYN: the data is still in the write
+	 * queue, send it again instead of waiting for the RTO.
+	 */
+	tcp_for_write_queue_from(data, sk) {
+		if (data == tcp_send_head(sk) ||
+		    tcp_retransmit_skb(sk, data))
+			break;
+	}
+	inet_csk_reset_xmit_timer(sk, ICSK_TIME_RETRANS,
+				  inet_csk(sk)->icsk_rto, TCP_RTO_MAX);
+	return 1;
+}
+
 static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 					 struct tcphdr *th, unsigned len)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	int saved_clamp = tp->rx_opt.mss_clamp;
 
-	tcp_parse_options(skb, &tp->rx_opt, 0);
+	tcp_parse_options(skb, &tp->rx_opt, 0, &foc);
 
 	if (th->ack) {
 		/* rfc793:
@@ -5351,10 +5426,11 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 		 *        a reset (unless the RST bit is set, if so drop
 		 *        the segment and return)"
 		 *
-		 *  We do not send data with SYN, so that RFC-correct
-		 *  test reduces to:
+		 *  With Fast Open the SYN may carry data, and the peer is
+		 *  free to ack only the SYN itself.
 		 */
-		if (TCP_SKB_CB(skb)->ack_seq != tp->snd_nxt)
+		if (!after(TCP_SKB_CB(skb)->ack_seq, tp->snd_una) ||
+		    after(TCP_SKB_CB(skb)->ack_seq, tp->snd_nxt))
 			goto reset_and_undo;
 
 		if (tp->rx_opt.saw_tstamp && tp->rx_opt.rcv_tsecr &&
@@ -5469,6 +5545,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 			sk_wake_async(sk, SOCK_WAKE_IO, POLL_OUT);
 		}
 
+		if ((tp->syn_fastopen || tp->syn_data) &&
+		    tcp_rcv_fastopen_synack(sk, skb, &foc))
+			return -1;
+
 		if (sk->sk_write_pending ||
 		    icsk->icsk_accept_queue.rskq_defer_accept ||
 		    icsk->icsk_ack.pingpong) {
@@ -5642,6 +5722,16 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		return 0;
 	}
 
+	/* A Fast Open child answers a retransmitted SYN with its SYN-ACK,
+	 * the sequence checks below would treat it as out of window.
+	 */
+	if (sk->sk_state == TCP_SYN_RECV && tp->fastopen_rsk &&
+	    th->syn && !th->ack && !th->rst &&
+	    TCP_SKB_CB(skb)->seq == tcp_rsk(tp->fastopen_rsk)->rcv_isn) {
+		tp->fastopen_rsk->rsk_ops->rtx_syn_ack(sk, tp->fastopen_rsk);
+		goto discard;
+	}
+
 	res = tcp_validate_incoming(sk, skb, th, 0);
 	if (res <= 0)
 		return -res;
@@ -5653,7 +5743,11 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		switch (sk->sk_state) {
 		case TCP_SYN_RECV:
 			if (acceptable) {
-				tp->copied_seq = tp->rcv_nxt;
+				/* A Fast Open child has queued the SYN data
+				 * already, it is still waiting to be read.
+				 */
+				if (!tp->fastopen_rsk)
+					tp->copied_seq = tp->rcv_nxt;
 				smp_mb();
 				tcp_set_state(sk, TCP_ESTABLISHED);
 				sk->sk_state_change(sk);
@@ -5761,6 +5855,12 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 			}
 			break;
 		}
+
+		/* Our SYN-ACK got acked, a passive Fast Open socket
+		 * has no further use for the request sock.
+		 */
+		if (acceptable && tp->fastopen_rsk)
+			tcp_fastopen_synack_acked(sk);
 	} else
 		goto discard;
 
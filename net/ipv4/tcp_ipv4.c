@@ -1169,10 +1169,98 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/*
+ * A SYN carrying data and a valid Fast Open cookie: create the child right
+ * away, queue the data on it and put it on the accept queue, so the
+ * application sees the request one round trip earlier.  The child keeps a
+ * copy of the request sock to retransmit the SYN-ACK until it is acked.
+ */
+static int tcp_v4_fastopen_create_child(struct sock *sk, struct sk_buff *skb,
+					struct request_sock *req)
+{
+	struct tcp_sock *tp;
+	struct request_sock *rsk;
+	struct sk_buff *data;
+	struct dst_entry *dst;
+	struct sock *child;
+	u32 end_seq = TCP_SKB_CB(skb)->end_seq;
+
+	dst = inet_csk_route_req(sk, req);
+	if (dst == NULL)
+		return -1;
+
+	rsk = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (rsk == NULL)
+		goto out_release;
+
+	tcp_rsk(req)->syn_data_len = end_seq - TCP_SKB_CB(skb)->seq - 1;
+	tcp_openreq_init_rwin(req, sk, dst);
+
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req,
+							 dst_clone(dst));
+	if (child == NULL)
+		goto out_free;
+
+	/* syn_recv_sock() took over the IP options, the copy holds none. */
+	memcpy(rsk, req, tcp_request_sock_ops.obj_size);
+	rsk->dl_next = NULL;
+	rsk->sk = NULL;
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = rsk;
+
+	data = skb_clone(skb, GFP_ATOMIC);
+	if (data != NULL) {
+		if (sk_rmem_schedule(child, data->truesize)) {
+			__skb_pull(data, tcp_hdr(data)->doff * 4);
+			skb_set_owner_r(data, child);
+			__skb_queue_tail(&child->sk_receive_queue, data);
+			tp->rcv_nxt = tp->rcv_wup = end_seq;
+			tcp_rsk(rsk)->syn_data_len = tcp_rsk(req)->syn_data_len;
+		} else {
+			__kfree_skb(data);
+			data = NULL;
+		}
+	}
+	if (data == NULL)
+		tcp_rsk(rsk)->syn_data_len = 0;
+
+	inet_csk_reqsk_queue_add(sk, req, child);
+	sk->sk_data_ready(sk, 0);
+
+	__tcp_v4_send_synack(child, rsk, dst);
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+
+out_free:
+	reqsk_free(rsk);
+out_release:
+	tcp_rsk(req)->syn_data_len = 0;
+	dst_release(dst);
+	return -1;
+}
+
+static int tcp_v4_fastopen_cookie_ok(struct sk_buff *skb,
+				     struct tcp_fastopen_cookie *foc)
+{
+	struct tcp_fastopen_cookie valid;
+
+	if (foc->len != TCP_FASTOPEN_COOKIE_SIZE)
+		return 0;
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, &valid);
+	return memcmp(foc->val, valid.val, TCP_FASTOPEN_COOKIE_SIZE) == 0;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct inet_request_sock *ireq;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	struct request_sock *req;
 	__be32 saddr = ip_hdr(skb)->saddr;
 	__be32 daddr = ip_hdr(skb)->daddr;
@@ -1221,7 +1309,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tmp_opt.mss_clamp = 536;
 	tmp_opt.user_mss  = tcp_sk(sk)->rx_opt.user_mss;
 
-	tcp_parse_options(skb, &tmp_opt, 0);
+	tcp_parse_options(skb, &tmp_opt, 0, &foc);
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1302,6 +1390,31 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	if (!want_cookie && foc.len >= 0 &&
+	    (sysctl_tcp_fastopen & TFO_SERVER_ENABLE) &&
+	    tcp_sk(sk)->fastopen_qlen > 0) {
+		struct tcphdr *th = tcp_hdr(skb);
+
+		if (TCP_SKB_CB(skb)->end_seq - TCP_SKB_CB(skb)->seq > 1 &&
+		    !th->fin &&
+		    sk->sk_ack_backlog < tcp_sk(sk)->fastopen_qlen &&
+		    tcp_v4_fastopen_cookie_ok(skb, &foc)) {
+			dst_release(dst);
+			if (!tcp_v4_fastopen_create_child(sk, skb, req)) {
+				NET_INC_STATS_BH(sock_net(sk),
+						 LINUX_MIB_TCPFASTOPENPASSIVE);
+				return 0;
+			}
+			dst = NULL;
+			NET_INC_STATS_BH(sock_net(sk),
+					 LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		} else if (!tcp_v4_fastopen_cookie_ok(skb, &foc)) {
+			tcp_rsk(req)->fastopen_cookie = 1;
+			NET_INC_STATS_BH(sock_net(sk),
+					 LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+		}
+	}
+
 	if (__tcp_v4_send_synack(sk, req, dst) || want_cookie)
 		goto drop_and_free;
 
@@ -1476,6 +1589,7 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 #endif
 
 	if (sk->sk_state == TCP_ESTABLISHED) { /* Fast path */
+		sock_rps_save_rxhash(sk, skb);
 		TCP_CHECK_TIMER(sk);
 		if (tcp_rcv_established(sk, skb, tcp_hdr(skb), skb->len)) {
 			rsk = sk;
@@ -1494,6 +1608,7 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 			goto discard;
 
 		if (nsk != sk) {
+			sock_rps_save_rxhash(nsk, skb);
 			if (tcp_child_process(sk, nsk, skb)) {
 				rsk = nsk;
 				goto reset;
@@ -1646,6 +1761,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1788,6 +1904,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 
 	sk->sk_write_space = sk_stream_write_space;
 	sock_set_flag(sk, SOCK_USE_WRITE_QUEUE);
+	INIT_LIST_HEAD(&tp->tsq_node);
 
 	icsk->icsk_af_ops = &ipv4_specific;
 	icsk->icsk_sync_mss = tcp_sync_mss;
@@ -1813,6 +1930,9 @@ void tcp_v4_destroy_sock(struct sock *sk)
 
 	tcp_cleanup_congestion_control(sk);
 
+	tcp_free_fastopen_rsk(tp);
+	tcp_free_fastopen_req(tp);
+
 	/* Cleanup up the write buffer. */
 	tcp_write_queue_purge(sk);
 
@@ -2399,6 +2519,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
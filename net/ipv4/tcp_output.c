@@ -38,6 +38,7 @@
 
 #include <linux/compiler.h>
 #include <linux/module.h>
+#include <linux/interrupt.h>
 
 /* People can turn this off for buggy TCP's found in printers etc. */
 int sysctl_tcp_retrans_collapse __read_mostly = 1;
@@ -59,6 +60,11 @@ int sysctl_tcp_base_mss __read_mostly = 512;
 /* By default, RFC2861 behavior.  */
 int sysctl_tcp_slow_start_after_idle __read_mostly = 1;
 
+/* Bytes a socket may have queued below it, in qdiscs and device rings.
+ * Zero disables the limit.
+ */
+int sysctl_tcp_limit_output_bytes __read_mostly = 131072;
+
 static void tcp_event_new_data_sent(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
@@ -353,6 +359,7 @@ static inline int tcp_urg_mode(const struct tcp_sock *tp)
 #define OPTION_SACK_ADVERTISE	(1 << 0)
 #define OPTION_TS		(1 << 1)
 #define OPTION_MD5		(1 << 2)
+#define OPTION_FAST_OPEN_COOKIE	(1 << 3)
 
 struct tcp_out_options {
 	u8 options;		/* bit field of OPTION_* */
@@ -360,6 +367,7 @@ struct tcp_out_options {
 	u8 num_sack_blocks;	/* number of SACK blocks to include */
 	u16 mss;		/* 0 to disable */
 	__u32 tsval, tsecr;	/* need to include OPTION_TS */
+	struct tcp_fastopen_cookie *fastopen_cookie;	/* Fast open cookie */
 };
 
 /* Beware: Something in the Internet is very sensitive to the ordering of
@@ -446,6 +454,30 @@ static void tcp_options_write(__be32 *ptr, struct tcp_sock *tp,
 			tp->rx_opt.eff_sacks = tp->rx_opt.num_sacks;
 		}
 	}
+
+	if (unlikely(OPTION_FAST_OPEN_COOKIE & opts->options)) {
+		struct tcp_fastopen_cookie *foc = opts->fastopen_cookie;
+		u8 *p = (u8 *)ptr;
+		u32 len = TCPOLEN_FASTOPEN_BASE + foc->len;
+
+		*p++ = TCPOPT_FASTOPEN;
+		*p++ = len;
+		memcpy(p, foc->val, foc->len);
+		p += foc->len;
+
+		/* pad to a 32 bit boundary */
+		while (len & 3) {
+			*p++ = TCPOPT_NOP;
+			len++;
+		}
+		ptr += len >> 2;
+	}
+}
+
+/* Space taken by a Fast Open option carrying @foc, 32 bit aligned */
+static inline unsigned tcp_fastopen_option_size(struct tcp_fastopen_cookie *foc)
+{
+	return (TCPOLEN_FASTOPEN_BASE + foc->len + 3) & ~3U;
 }
 
 static unsigned tcp_syn_options(struct sock *sk, struct sk_buff *skb,
@@ -493,6 +525,20 @@ static unsigned tcp_syn_options(struct sock *sk, struct sk_buff *skb,
 			size += TCPOLEN_SACKPERM_ALIGNED;
 	}
 
+	/* Send our cached cookie, or an empty option to ask for one */
+	if (unlikely(tp->fastopen_req) &&
+	    tp->fastopen_req->cookie.len >= 0) {
+		struct tcp_fastopen_cookie *foc = &tp->fastopen_req->cookie;
+		unsigned need = tcp_fastopen_option_size(foc);
+
+		if (MAX_TCP_OPTION_SPACE - size >= need) {
+			opts->options |= OPTION_FAST_OPEN_COOKIE;
+			opts->fastopen_cookie = foc;
+			size += need;
+			tp->syn_fastopen = 1;
+		}
+	}
+
 	return size;
 }
 
@@ -500,7 +546,8 @@ static unsigned tcp_synack_options(struct sock *sk,
 				   struct request_sock *req,
 				   unsigned mss, struct sk_buff *skb,
 				   struct tcp_out_options *opts,
-				   struct tcp_md5sig_key **md5) {
+				   struct tcp_md5sig_key **md5,
+				   struct tcp_fastopen_cookie *foc) {
 	unsigned size = 0;
 	struct inet_request_sock *ireq = inet_rsk(req);
 	char doing_ts;
@@ -541,6 +588,17 @@ static unsigned tcp_synack_options(struct sock *sk,
 			size += TCPOLEN_SACKPERM_ALIGNED;
 	}
 
+	/* The SYN asked for a Fast Open cookie, or carried a stale one */
+	if (unlikely(tcp_rsk(req)->fastopen_cookie)) {
+		tcp_fastopen_cookie_gen(ireq->rmt_addr, foc);
+		if (MAX_TCP_OPTION_SPACE - size >=
+		    tcp_fastopen_option_size(foc)) {
+			opts->options |= OPTION_FAST_OPEN_COOKIE;
+			opts->fastopen_cookie = foc;
+			size += tcp_fastopen_option_size(foc);
+		}
+	}
+
 	return size;
 }
 
@@ -635,12 +693,18 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 							   &md5);
 	tcp_header_size = tcp_options_size + sizeof(struct tcphdr);
 
-	if (tcp_packets_in_flight(tp) == 0)
+	if (tcp_packets_in_flight(tp) == 0) {
 		tcp_ca_event(sk, CA_EVENT_TX_START);
+		/* Nothing in flight, the flow may move to another queue */
+		skb->ooo_okay = 1;
+	} else
+		skb->ooo_okay = 0;
 
 	skb_push(skb, tcp_header_size);
 	skb_reset_transport_header(skb);
 	skb_set_owner_w(skb, sk);
+	if (sysctl_tcp_limit_output_bytes > 0)
+		skb->destructor = tcp_wfree;
 
 	/* Build TCP header and checksum it. */
 	th = tcp_hdr(skb);
@@ -1563,6 +1627,23 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 				break;
 		}
 
+		/* TCP Small Queues: sk_wmem_alloc counts the truesize of
+		 * everything we handed to the qdisc and not yet freed by
+		 * the driver.  Stop here and let tcp_wfree() restart us.
+		 */
+		if (sysctl_tcp_limit_output_bytes > 0 &&
+		    atomic_read(&sk->sk_wmem_alloc) >=
+		    sysctl_tcp_limit_output_bytes) {
+			set_bit(TSQ_THROTTLED, &tp->tsq_flags);
+			/* The last skb may have been freed before the bit
+			 * was set, in which case nobody would wake us up.
+			 */
+			smp_mb__after_clear_bit();
+			if (atomic_read(&sk->sk_wmem_alloc) >=
+			    sysctl_tcp_limit_output_bytes)
+				break;
+		}
+
 		limit = mss_now;
 		if (tso_segs > 1 && !tcp_urg_mode(tp))
 			limit = tcp_mss_split_point(sk, skb, mss_now,
@@ -1596,6 +1677,112 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 	return !tp->packets_out && tcp_send_head(sk);
 }
 
+/* TCP Small Queues:
+ * Once a socket has sysctl_tcp_limit_output_bytes queued in qdiscs and
+ * device rings, tcp_write_xmit() stops.  When one of those skbs is freed
+ * (TX completion), tcp_wfree() puts the socket on a per-cpu list and a
+ * tasklet resumes transmission.  If the socket is owned by the user at
+ * that point, the work is left to tcp_release_cb().
+ */
+struct tsq_tasklet {
+	struct tasklet_struct	tasklet;
+	struct list_head	head; /* queue of tcp sockets */
+};
+static DEFINE_PER_CPU(struct tsq_tasklet, tsq_tasklet);
+
+static void tcp_tsq_handler(struct sock *sk)
+{
+	if ((1 << sk->sk_state) &
+	    (TCPF_ESTABLISHED | TCPF_FIN_WAIT1 | TCPF_CLOSING |
+	     TCPF_CLOSE_WAIT  | TCPF_LAST_ACK))
+		tcp_write_xmit(sk, tcp_current_mss(sk, 1), tcp_sk(sk)->nonagle,
+			       0, GFP_ATOMIC);
+}
+
+static void tcp_tasklet_func(unsigned long data)
+{
+	struct tsq_tasklet *tsq = (struct tsq_tasklet *)data;
+	LIST_HEAD(list);
+	unsigned long flags;
+	struct list_head *q, *n;
+	struct tcp_sock *tp;
+	struct sock *sk;
+
+	local_irq_save(flags);
+	list_splice_init(&tsq->head, &list);
+	local_irq_restore(flags);
+
+	list_for_each_safe(q, n, &list) {
+		tp = list_entry(q, struct tcp_sock, tsq_node);
+		list_del(&tp->tsq_node);
+
+		sk = (struct sock *)tp;
+		bh_lock_sock(sk);
+
+		if (!sock_owned_by_user(sk))
+			tcp_tsq_handler(sk);
+		else
+			set_bit(TCP_TSQ_DEFERRED, &tp->tsq_flags);
+
+		bh_unlock_sock(sk);
+
+		clear_bit(TSQ_QUEUED, &tp->tsq_flags);
+		/* Drop the reference tcp_wfree() kept for us */
+		sock_put(sk);
+	}
+}
+
+/* Called from release_sock() with the socket spinlock held */
+void tcp_release_cb(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (test_and_clear_bit(TCP_TSQ_DEFERRED, &tp->tsq_flags))
+		tcp_tsq_handler(sk);
+}
+EXPORT_SYMBOL(tcp_release_cb);
+
+void __init tcp_tasklet_init(void)
+{
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct tsq_tasklet *tsq = &per_cpu(tsq_tasklet, i);
+
+		INIT_LIST_HEAD(&tsq->head);
+		tasklet_init(&tsq->tasklet, tcp_tasklet_func,
+			     (unsigned long)tsq);
+	}
+}
+
+/*
+ * Write buffer destructor for skbs sent by TCP.  Like sock_wfree(), but
+ * restarts a socket that tcp_write_xmit() throttled.  In that case the
+ * socket reference taken by skb_set_owner_w() is handed to the tasklet.
+ */
+void tcp_wfree(struct sk_buff *skb)
+{
+	struct sock *sk = skb->sk;
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (test_and_clear_bit(TSQ_THROTTLED, &tp->tsq_flags) &&
+	    !test_and_set_bit(TSQ_QUEUED, &tp->tsq_flags)) {
+		unsigned long flags;
+		struct tsq_tasklet *tsq;
+
+		atomic_sub(skb->truesize, &sk->sk_wmem_alloc);
+
+		/* queue this socket to the tasklet queue */
+		local_irq_save(flags);
+		tsq = &__get_cpu_var(tsq_tasklet);
+		list_add(&tp->tsq_node, &tsq->head);
+		tasklet_schedule(&tsq->tasklet);
+		local_irq_restore(flags);
+	} else {
+		sock_wfree(skb);
+	}
+}
+
 /* Push out any pending frames which were held back due to
  * TCP_CORK or attempt at coalescing tiny packets.
  * The socket must be locked by the caller.
@@ -2201,6 +2388,7 @@ struct sk_buff *tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 	struct tcp_out_options opts;
 	struct sk_buff *skb;
 	struct tcp_md5sig_key *md5;
+	struct tcp_fastopen_cookie foc;
 	__u8 *md5_hash_location;
 	int mss;
 
@@ -2217,19 +2405,8 @@ struct sk_buff *tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 	if (tp->rx_opt.user_mss && tp->rx_opt.user_mss < mss)
 		mss = tp->rx_opt.user_mss;
 
-	if (req->rcv_wnd == 0) { /* ignored for retransmitted syns */
-		__u8 rcv_wscale;
-		/* Set this up on the first call only */
-		req->window_clamp = tp->window_clamp ? : dst_metric(dst, RTAX_WINDOW);
-		/* tcp_full_space because it is guaranteed to be the first packet */
-		tcp_select_initial_window(tcp_full_space(sk),
-			mss - (ireq->tstamp_ok ? TCPOLEN_TSTAMP_ALIGNED : 0),
-			&req->rcv_wnd,
-			&req->window_clamp,
-			ireq->wscale_ok,
-			&rcv_wscale);
-		ireq->rcv_wscale = rcv_wscale;
-	}
+	if (req->rcv_wnd == 0) /* ignored for retransmitted syns */
+		tcp_openreq_init_rwin(req, sk, dst);
 
 	memset(&opts, 0, sizeof(opts));
 #ifdef CONFIG_SYN_COOKIES
@@ -2239,7 +2416,7 @@ struct sk_buff *tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 #endif
 	TCP_SKB_CB(skb)->when = tcp_time_stamp;
 	tcp_header_size = tcp_synack_options(sk, req, mss,
-					     skb, &opts, &md5) +
+					     skb, &opts, &md5, &foc) +
 			  sizeof(struct tcphdr);
 
 	skb_push(skb, tcp_header_size);
@@ -2258,7 +2435,8 @@ struct sk_buff *tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 	tcp_init_nondata_skb(skb, tcp_rsk(req)->snt_isn,
 			     TCPCB_FLAG_SYN | TCPCB_FLAG_ACK);
 	th->seq = htonl(TCP_SKB_CB(skb)->seq);
-	th->ack_seq = htonl(tcp_rsk(req)->rcv_isn + 1);
+	th->ack_seq = htonl(tcp_rsk(req)->rcv_isn + 1 +
+			    tcp_rsk(req)->syn_data_len);
 
 	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled. */
 	th->window = htons(min(req->rcv_wnd, 65535U));
@@ -2277,6 +2455,31 @@ struct sk_buff *tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 	return skb;
 }
 
+/* Set up the receive window of a request sock, done on the first SYN-ACK
+ * or, for Fast Open, before the child socket is created from @req.
+ */
+void tcp_openreq_init_rwin(struct request_sock *req, struct sock *sk,
+			   struct dst_entry *dst)
+{
+	struct inet_request_sock *ireq = inet_rsk(req);
+	struct tcp_sock *tp = tcp_sk(sk);
+	__u8 rcv_wscale;
+	int mss = dst_metric(dst, RTAX_ADVMSS);
+
+	if (tp->rx_opt.user_mss && tp->rx_opt.user_mss < mss)
+		mss = tp->rx_opt.user_mss;
+
+	req->window_clamp = tp->window_clamp ? : dst_metric(dst, RTAX_WINDOW);
+	/* tcp_full_space because it is guaranteed to be the first packet */
+	tcp_select_initial_window(tcp_full_space(sk),
+		mss - (ireq->tstamp_ok ? TCPOLEN_TSTAMP_ALIGNED : 0),
+		&req->rcv_wnd,
+		&req->window_clamp,
+		ireq->wscale_ok,
+		&rcv_wscale);
+	ireq->rcv_wscale = rcv_wscale;
+}
+
 /*
  * Do all connect socket setups that can be done AF independent.
  */
@@ -2338,6 +2541,86 @@ static void tcp_connect_init(struct sock *sk)
 	tcp_clear_retrans(tp);
 }
 
+/* Queue a segment sent during connect, it stays in the write queue
+ * until it is acked like any other transmitted segment.
+ */
+static void tcp_connect_queue_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	TCP_SKB_CB(skb)->when = tcp_time_stamp;
+	skb_header_release(skb);
+	__tcp_add_write_queue_tail(sk, skb);
+	sk->sk_wmem_queued += skb->truesize;
+	sk_mem_charge(sk, skb->truesize);
+	tp->write_seq = TCP_SKB_CB(skb)->end_seq;
+	tp->packets_out += tcp_skb_pcount(skb);
+}
+
+/* Send a SYN carrying the first bytes of tp->fastopen_req.  The plain SYN
+ * @syn is queued already and is what gets retransmitted; the data is
+ * queued behind it as an ordinary segment, so a server that ignores the
+ * data in the SYN simply has it retransmitted after the handshake.
+ * Without a cookie for the peer only the cookie request goes out.
+ */
+static int tcp_send_syn_data(struct sock *sk, struct sk_buff *syn)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tcp_fastopen_request *fo = tp->fastopen_req;
+	struct sk_buff *syn_data = NULL, *data;
+	int space, err;
+
+	tcp_fastopen_cache_get(sk, &fo->cookie);
+	if (fo->cookie.len <= 0)
+		goto fallback;
+
+	/* Leave room for the largest option set a SYN can carry */
+	space = tcp_mtu_to_mss(sk, inet_csk(sk)->icsk_pmtu_cookie) -
+		MAX_TCP_OPTION_SPACE;
+	space = min_t(size_t, space, fo->size);
+	if (space <= 0)
+		goto fallback;
+
+	data = sk_stream_alloc_skb(sk, space, sk->sk_allocation);
+	if (data == NULL)
+		goto fallback;
+	if (memcpy_fromiovecend(skb_put(data, space), fo->data->msg_iov,
+				0, space))
+		goto free_data;
+
+	syn_data = alloc_skb(MAX_TCP_HEADER + space, sk->sk_allocation);
+	if (syn_data == NULL)
+		goto free_data;
+	skb_reserve(syn_data, MAX_TCP_HEADER);
+	memcpy(skb_put(syn_data, space), data->data, space);
+
+	tcp_init_nondata_skb(syn_data, TCP_SKB_CB(syn)->seq,
+			     TCP_SKB_CB(syn)->flags);
+	TCP_SKB_CB(syn_data)->end_seq += space;
+	TCP_SKB_CB(syn_data)->when = TCP_SKB_CB(syn)->when;
+	syn_data->csum = csum_partial(syn_data->data, space, 0);
+
+	tcp_init_nondata_skb(data, tp->write_seq,
+			     TCPCB_FLAG_ACK | TCPCB_FLAG_PSH);
+	TCP_SKB_CB(data)->end_seq += space;
+	data->csum = csum_partial(data->data, space, 0);
+	tcp_connect_queue_skb(sk, data);
+
+	err = tcp_transmit_skb(sk, syn_data, 0, sk->sk_allocation);
+	if (err)
+		return err;
+
+	fo->copied = space;
+	tp->syn_data = 1;
+	NET_INC_STATS(sock_net(sk), LINUX_MIB_TCPFASTOPENACTIVE);
+	return 0;
+
+free_data:
+	__kfree_skb(data);
+fallback:
+	return tcp_transmit_skb(sk, syn, 1, sk->sk_allocation);
+}
+
 /*
  * Build a SYN and send it off.
  */
@@ -2367,7 +2650,10 @@ int tcp_connect(struct sock *sk)
 	sk->sk_wmem_queued += buff->truesize;
 	sk_mem_charge(sk, buff->truesize);
 	tp->packets_out += tcp_skb_pcount(buff);
-	tcp_transmit_skb(sk, buff, 1, GFP_KERNEL);
+	if (unlikely(tp->fastopen_req))
+		tcp_send_syn_data(sk, buff);
+	else
+		tcp_transmit_skb(sk, buff, 1, GFP_KERNEL);
 
 	/* We change tp->snd_nxt after the tcp_transmit_skb() call
 	 * in order to make this packet get counted in tcpOutSegs.
@@ -131,12 +131,15 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	uid_t uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net)			&&
 		    sk2 != sk					&&
 		    (bitmap || sk2->sk_hash == num)		&&
 		    (!sk2->sk_reuse || !sk->sk_reuse)		&&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport	||
+		     uid != sock_i_uid(sk2))			&&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if
 			|| sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -283,18 +286,36 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash = udp_hashfn(net, hnum);
 	struct udp_hslot *hslot = &udptable->hash[hash];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 phash = 0;
 
 	rcu_read_lock();
 begin:
 	result = NULL;
 	badness = -1;
+	matches = 0;
+	reuseport = 0;
 	sk_nulls_for_each_rcu(sk, node, &hslot->head) {
 		score = compute_score(sk, net, saddr, hnum, sport,
 				      daddr, dport, dif);
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				phash = inet_ehashfn(net, daddr, hnum,
+						     saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			/*
+			 * Spread datagrams over the SO_REUSEPORT group,
+			 * keeping each flow on one socket.
+			 */
+			matches++;
+			if (((u64)phash * matches) >> 32 == 0)
+				result = sk;
+			phash = next_pseudo_random32(phash);
 		}
 	}
 	/*
@@ -568,6 +589,70 @@ out:
 	return err;
 }
 
+static inline unsigned int udp_policy_genid(void)
+{
+#ifdef CONFIG_XFRM
+	return atomic_read(&flow_cache_genid);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Unconnected senders often send several datagrams in a row to the same
+ * peer, sendmmsg() batches in particular.  The route of the last such
+ * send is kept and reused while it is still valid and was looked up for
+ * the same key.  Routes through IPsec are not kept, and a change of the
+ * policies makes the kept one stale.
+ */
+static struct rtable *udp_last_route(struct sock *sk, __be32 daddr,
+				     __be32 saddr, u8 tos, int oif)
+{
+	struct udp_sock *up = udp_sk(sk);
+	struct rtable *rt;
+
+#ifdef CONFIG_XFRM
+	if (sk->sk_policy[XFRM_POLICY_OUT])
+		return NULL;
+#endif
+	read_lock(&sk->sk_dst_lock);
+	rt = (struct rtable *)up->last_dst;
+	if (rt && rt->fl.fl4_dst == daddr && rt->fl.fl4_src == saddr &&
+	    rt->fl.oif == oif &&
+	    !((rt->fl.fl4_tos ^ tos) & (IPTOS_RT_MASK | RTO_ONLINK)) &&
+	    up->last_dst_genid == udp_policy_genid())
+		dst_hold(&rt->u.dst);
+	else
+		rt = NULL;
+	read_unlock(&sk->sk_dst_lock);
+
+	if (rt && rt->u.dst.obsolete &&
+	    rt->u.dst.ops->check(&rt->u.dst, 0) == NULL) {
+		ip_rt_put(rt);
+		rt = NULL;
+	}
+	return rt;
+}
+
+static void udp_set_last_route(struct sock *sk, struct rtable *rt,
+			       unsigned int genid)
+{
+	struct udp_sock *up = udp_sk(sk);
+	struct dst_entry *old;
+
+	if (rt->u.dst.xfrm ||
+	    (rt->rt_flags & (RTCF_BROADCAST|RTCF_MULTICAST)) ||
+	    inet_sk_flowi_flags(sk))
+		return;
+
+	write_lock(&sk->sk_dst_lock);
+	old = up->last_dst;
+	up->last_dst = dst_clone(&rt->u.dst);
+	up->last_dst_genid = genid;
+	write_unlock(&sk->sk_dst_lock);
+	dst_release(old);
+}
+
 int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t len)
 {
@@ -681,6 +766,8 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	if (connected)
 		rt = (struct rtable*)sk_dst_check(sk, 0);
+	else
+		rt = udp_last_route(sk, faddr, saddr, tos, ipc.oif);
 
 	if (rt == NULL) {
 		struct flowi fl = { .oif = ipc.oif,
@@ -694,6 +781,7 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 					       { .sport = inet->sport,
 						 .dport = dport } } };
 		struct net *net = sock_net(sk);
+		unsigned int genid = udp_policy_genid();
 
 		security_sk_classify_flow(sk, &fl);
 		err = ip_route_output_flow(net, &rt, &fl, sk, 1);
@@ -709,6 +797,8 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 			goto out;
 		if (connected)
 			sk_dst_set(sk, dst_clone(&rt->u.dst));
+		else
+			udp_set_last_route(sk, rt, genid);
 	}
 
 	if (msg->msg_flags&MSG_CONFIRM)
@@ -892,6 +982,8 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (flags & MSG_ERRQUEUE)
 		return ip_recv_error(sk, msg, len);
 
+	sock_rps_record_flow(sk);
+
 try_again:
 	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
 				  &peeked, &err);
@@ -1013,6 +1105,10 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	int is_udplite = IS_UDPLITE(sk);
 	int rc;
 
+	/* Only connected sockets have a single flow to steer */
+	if (inet_sk(sk)->daddr)
+		sock_rps_save_rxhash(sk, skb);
+
 	if ((rc = sock_queue_rcv_skb(sk, skb)) < 0) {
 		/* Note that an ENOMEM error is charged twice */
 		if (rc == -ENOMEM) {
@@ -1336,6 +1432,7 @@ void udp_destroy_sock(struct sock *sk)
 	lock_sock(sk);
 	udp_flush_pending_frames(sk);
 	release_sock(sk);
+	udp_lib_release_dst(sk);
 }
 
 /*
@@ -42,6 +42,30 @@ static inline int qdisc_qlen(struct Qdisc *q)
 	return q->q.qlen;
 }
 
+/*
+ * Packets handed to the driver in one go are chained through skb->next,
+ * see try_bulk_dequeue_skb().  A packet needing software GSO uses
+ * skb->next for its own segments instead, and is always last in a chain.
+ */
+static inline struct sk_buff *bulk_skb_next(struct net_device *dev,
+					    struct sk_buff *skb)
+{
+	return netif_needs_gso(dev, skb) ? NULL : skb->next;
+}
+
+static void qdisc_free_requeued(struct Qdisc *q)
+{
+	struct sk_buff *skb = q->gso_skb;
+
+	while (skb) {
+		struct sk_buff *next = bulk_skb_next(qdisc_dev(q), skb);
+
+		kfree_skb(skb);
+		skb = next;
+	}
+	q->gso_skb = NULL;
+}
+
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 {
 	q->gso_skb = skb;
@@ -51,6 +75,39 @@ static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 	return 0;
 }
 
+static inline int qdisc_avail_bulklimit(const struct netdev_queue *txq)
+{
+#ifdef CONFIG_BQL
+	/* drivers not reporting to BQL always have a zero budget */
+	return dql_avail(&txq->dql);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * A qdisc feeding a single tx queue may hand the driver more than one
+ * packet per HARD_TX_LOCK, as long as byte queue limits say the queue
+ * can take them.  The chain stops after a packet needing software GSO.
+ */
+static void try_bulk_dequeue_skb(struct Qdisc *q, struct sk_buff *skb)
+{
+	struct net_device *dev = qdisc_dev(q);
+	int bytelimit = qdisc_avail_bulklimit(q->dev_queue) - skb->len;
+
+	while (bytelimit > 0 && !netif_needs_gso(dev, skb)) {
+		struct sk_buff *nskb = q->dequeue(q);
+
+		if (!nskb)
+			break;
+
+		bytelimit -= nskb->len;
+		skb->next = nskb;
+		skb = nskb;
+	}
+	skb->next = NULL;
+}
+
 static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
 	struct sk_buff *skb = q->gso_skb;
@@ -61,17 +118,52 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
-		if (!netif_tx_queue_stopped(txq) && !netif_tx_queue_frozen(txq))
+		if (!netif_xmit_stopped(txq) && !netif_tx_queue_frozen(txq))
 			q->gso_skb = NULL;
 		else
 			skb = NULL;
 	} else {
 		skb = q->dequeue(q);
+		if (skb && (q->flags & TCQ_F_ONETXQUEUE))
+			try_bulk_dequeue_skb(q, skb);
 	}
 
 	return skb;
 }
 
+/*
+ * Send a chain from dequeue_skb() to the driver, under the tx lock.
+ * Returns NULL once everything went out, otherwise the unsent part of
+ * the chain, with the reason in *ret.
+ */
+static struct sk_buff *xmit_skb_chain(struct sk_buff *skb,
+				      struct net_device *dev,
+				      struct netdev_queue *txq, int *ret)
+{
+	while (skb) {
+		struct sk_buff *next = bulk_skb_next(dev, skb);
+
+		if (next)
+			skb->next = NULL;
+
+		*ret = dev_hard_start_xmit(skb, dev, txq);
+		if (unlikely(*ret != NETDEV_TX_OK)) {
+			if (next)
+				skb->next = next;
+			return skb;
+		}
+
+		skb = next;
+		if (skb && (netif_xmit_stopped(txq) ||
+			    netif_tx_queue_frozen(txq))) {
+			*ret = NETDEV_TX_BUSY;
+			return skb;
+		}
+	}
+
+	return NULL;
+}
+
 static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 					   struct netdev_queue *dev_queue,
 					   struct Qdisc *q)
@@ -85,7 +177,12 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 		 * detect it by checking xmit owner and drop the packet when
 		 * deadloop is detected. Return OK to try the next skb.
 		 */
-		kfree_skb(skb);
+		do {
+			struct sk_buff *next = bulk_skb_next(dev_queue->dev, skb);
+
+			kfree_skb(skb);
+			skb = next;
+		} while (skb);
 		if (net_ratelimit())
 			printk(KERN_WARNING "Dead loop on netdevice %s, "
 			       "fix it urgently!\n", dev_queue->dev->name);
@@ -103,48 +200,28 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 }
 
 /*
- * NOTE: Called under qdisc_lock(q) with locally disabled BH.
+ * Transmit one skb, or a chain of them, and handle the returned status.
  *
- * __QDISC_STATE_RUNNING guarantees only one CPU can process
- * this qdisc at a time. qdisc_lock(q) serializes queue accesses for
- * this queue.
- *
- *  netif_tx_lock serializes accesses to device driver.
- *
- *  qdisc_lock(q) and netif_tx_lock are mutually exclusive,
- *  if one is grabbed, another must be free.
- *
- * Note, that this procedure can be called by a watchdog timer
+ * Called with root_lock held, which is dropped around the driver call.
+ * __QDISC_STATE_RUNNING must be owned by the caller.
  *
  * Returns to the caller:
  *				0  - queue is empty or throttled.
  *				>0 - queue is not empty.
- *
  */
-static inline int qdisc_restart(struct Qdisc *q)
+int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
+		    struct net_device *dev, struct netdev_queue *txq,
+		    spinlock_t *root_lock)
 {
-	struct netdev_queue *txq;
 	int ret = NETDEV_TX_BUSY;
-	struct net_device *dev;
-	spinlock_t *root_lock;
-	struct sk_buff *skb;
-
-	/* Dequeue packet */
-	if (unlikely((skb = dequeue_skb(q)) == NULL))
-		return 0;
-
-	root_lock = qdisc_lock(q);
 
 	/* And release qdisc */
 	spin_unlock(root_lock);
 
-	dev = qdisc_dev(q);
-	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
-
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_tx_queue_stopped(txq) &&
+	if (!netif_xmit_stopped(txq) &&
 	    !netif_tx_queue_frozen(txq))
-		ret = dev_hard_start_xmit(skb, dev, txq);
+		skb = xmit_skb_chain(skb, dev, txq, &ret);
 	HARD_TX_UNLOCK(dev, txq);
 
 	spin_lock(root_lock);
@@ -170,13 +247,51 @@ static inline int qdisc_restart(struct Qdisc *q)
 		break;
 	}
 
-	if (ret && (netif_tx_queue_stopped(txq) ||
+	if (ret && (netif_xmit_stopped(txq) ||
 		    netif_tx_queue_frozen(txq)))
 		ret = 0;
 
 	return ret;
 }
 
+/*
+ * NOTE: Called under qdisc_lock(q) with locally disabled BH.
+ *
+ * __QDISC_STATE_RUNNING guarantees only one CPU can process
+ * this qdisc at a time. qdisc_lock(q) serializes queue accesses for
+ * this queue.
+ *
+ *  netif_tx_lock serializes accesses to device driver.
+ *
+ *  qdisc_lock(q) and netif_tx_lock are mutually exclusive,
+ *  if one is grabbed, another must be free.
+ *
+ * Note, that this procedure can be called by a watchdog timer
+ *
+ * Returns to the caller:
+ *				0  - queue is empty or throttled.
+ *				>0 - queue is not empty.
+ *
+ */
+static inline int qdisc_restart(struct Qdisc *q)
+{
+	struct netdev_queue *txq;
+	struct net_device *dev;
+	spinlock_t *root_lock;
+	struct sk_buff *skb;
+
+	/* Dequeue packet */
+	skb = dequeue_skb(q);
+	if (unlikely(!skb))
+		return 0;
+
+	root_lock = qdisc_lock(q);
+	dev = qdisc_dev(q);
+	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
+
+	return sch_direct_xmit(skb, q, dev, txq, root_lock);
+}
+
 void __qdisc_run(struct Qdisc *q)
 {
 	unsigned long start_time = jiffies;
@@ -333,6 +448,7 @@ struct Qdisc noop_qdisc = {
 	.list		=	LIST_HEAD_INIT(noop_qdisc.list),
 	.q.lock		=	__SPIN_LOCK_UNLOCKED(noop_qdisc.q.lock),
 	.dev_queue	=	&noop_netdev_queue,
+	.busylock	=	__SPIN_LOCK_UNLOCKED(noop_qdisc.busylock),
 };
 EXPORT_SYMBOL(noop_qdisc);
 
@@ -359,6 +475,7 @@ static struct Qdisc noqueue_qdisc = {
 	.list		=	LIST_HEAD_INIT(noqueue_qdisc.list),
 	.q.lock		=	__SPIN_LOCK_UNLOCKED(noqueue_qdisc.q.lock),
 	.dev_queue	=	&noqueue_netdev_queue,
+	.busylock	=	__SPIN_LOCK_UNLOCKED(noqueue_qdisc.busylock),
 };
 
 
@@ -450,6 +567,8 @@ static int pfifo_fast_init(struct Qdisc *qdisc, struct nlattr *opt)
 	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++)
 		skb_queue_head_init(list + prio);
 
+	/* can do direct xmit when empty */
+	qdisc->flags |= TCQ_F_CAN_BYPASS;
 	return 0;
 }
 
@@ -485,6 +604,7 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 
 	INIT_LIST_HEAD(&sch->list);
 	skb_queue_head_init(&sch->q);
+	spin_lock_init(&sch->busylock);
 	sch->ops = ops;
 	sch->enqueue = ops->enqueue;
 	sch->dequeue = ops->dequeue;
@@ -527,8 +647,7 @@ void qdisc_reset(struct Qdisc *qdisc)
 	if (ops->reset)
 		ops->reset(qdisc);
 
-	kfree_skb(qdisc->gso_skb);
-	qdisc->gso_skb = NULL;
+	qdisc_free_requeued(qdisc);
 }
 EXPORT_SYMBOL(qdisc_reset);
 
@@ -551,10 +670,10 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	if (ops->destroy)
 		ops->destroy(qdisc);
 
+	qdisc_free_requeued(qdisc);
 	module_put(ops->owner);
 	dev_put(qdisc_dev(qdisc));
 
-	kfree_skb(qdisc->gso_skb);
 	kfree((char *) qdisc - qdisc->padded);
 }
 EXPORT_SYMBOL(qdisc_destroy);
@@ -585,6 +704,8 @@ static void attach_one_default_qdisc(struct net_device *dev,
 			printk(KERN_INFO "%s: activation failed\n", dev->name);
 			return;
 		}
+		/* one default qdisc per tx queue */
+		qdisc->flags |= TCQ_F_ONETXQUEUE;
 	} else {
 		qdisc =  &noqueue_qdisc;
 	}
@@ -27,8 +27,9 @@ struct kvm_io_device {
 		      gpa_t addr,
 		      int len,
 		      const void *val);
+	/* val is the value being written, NULL for reads */
 	int (*in_range)(struct kvm_io_device *this, gpa_t addr, int len,
-			int is_write);
+			int is_write, const void *val);
 	void (*destructor)(struct kvm_io_device *this);
 
 	void             *private;
@@ -51,9 +52,10 @@ static inline void kvm_iodevice_write(struct kvm_io_device *dev,
 }
 
 static inline int kvm_iodevice_inrange(struct kvm_io_device *dev,
-				       gpa_t addr, int len, int is_write)
+				       gpa_t addr, int len, int is_write,
+				       const void *val)
 {
-	return dev->in_range(dev, addr, len, is_write);
+	return dev->in_range(dev, addr, len, is_write, val);
 }
 
 static inline void kvm_iodevice_destructor(struct kvm_io_device *dev)